@@ -0,0 +1,174 @@
+#pragma once
+
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <halp/geometry.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <type_traits>
+
+namespace Threedim
+{
+static constexpr int64_t dynamic_stride = -1;
+
+/**
+ * @brief Typed view over one vertex attribute of a geometry buffer.
+ *
+ * Elements are `stride` bytes apart: for packed layouts (one buffer region per attribute)
+ * the stride is the size of the element and is known at compile time,
+ * for interleaved layouts it is the stride of the binding.
+ *
+ * A dynamic stride is always given explicitly: sizeof(T) is not a safe guess, e.g.
+ * a float[3] view on a float4 attribute.
+ */
+template <typename T, int64_t Stride = dynamic_stride>
+class attribute_span
+{
+  using byte_type = std::conditional_t<std::is_const_v<T>, const std::byte, std::byte>;
+
+public:
+  using element_type = T;
+
+  attribute_span() = default;
+  attribute_span(byte_type* data, int64_t count, int64_t stride) noexcept
+      : m_data{data}
+      , m_count{count}
+      , m_stride{stride}
+  {
+  }
+
+  attribute_span(byte_type* data, int64_t count) noexcept
+    requires(Stride != dynamic_stride)
+      : m_data{data}
+      , m_count{count}
+  {
+  }
+
+  //! Read-only view on a mutable attribute
+  template <typename U>
+    requires std::is_same_v<const U, T>
+  attribute_span(attribute_span<U, Stride> other) noexcept
+      : m_data{other.data()}
+      , m_count{other.size()}
+      , m_stride{other.stride()}
+  {
+  }
+
+  T& operator[](int64_t i) const noexcept
+  {
+    return *reinterpret_cast<T*>(m_data + i * stride());
+  }
+
+  int64_t size() const noexcept { return m_count; }
+  bool empty() const noexcept { return m_count == 0; }
+  byte_type* data() const noexcept { return m_data; }
+
+  constexpr int64_t stride() const noexcept
+  {
+    if constexpr (Stride == dynamic_stride)
+      return m_stride;
+    else
+      return Stride;
+  }
+
+  bool packed() const noexcept { return stride() == int64_t(sizeof(T)); }
+
+  attribute_span subspan(int64_t offset, int64_t count) const noexcept
+  {
+    return {m_data + offset * stride(), count, stride()};
+  }
+
+  //! The fast path for attributes which are not interleaved with others
+  attribute_span<T, int64_t(sizeof(T))> as_packed() const noexcept
+  {
+    return {m_data, m_count};
+  }
+
+private:
+  byte_type* m_data{};
+  int64_t m_count{};
+  int64_t m_stride{Stride};
+};
+
+//! Number of components of an attribute format, 0 if not made of floats
+inline int float_components(decltype(halp::dynamic_geometry::attribute::format) fmt) noexcept
+{
+  using attr = halp::dynamic_geometry::attribute;
+  switch (fmt)
+  {
+    case attr::float4:
+      return 4;
+    case attr::float3:
+      return 3;
+    case attr::float2:
+      return 2;
+    case attr::float1:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/**
+ * @brief Bytes between the values of an attribute for two consecutive vertices.
+ *
+ * That is the stride of its binding, or the size of the attribute itself for
+ * bindings which do not set one: they hold that attribute alone.
+ */
+template <typename Geometry, typename Attribute>
+int64_t attribute_stride(const Geometry& mesh, const Attribute& attr) noexcept
+{
+  const int binding = attr.binding;
+  if (binding >= 0 && binding < std::ssize(mesh.bindings)
+      && mesh.bindings[binding].stride > 0)
+    return mesh.bindings[binding].stride;
+  return float_components(attr.format) * int64_t(sizeof(float));
+}
+
+/**
+ * @brief Resolves an attribute through attributes / bindings / input into a typed view.
+ *
+ * T must be an array of N floats and the attribute must have at least N float components.
+ * Returns nothing if the geometry has no such attribute or if it points outside its buffer.
+ */
+template <typename T, typename Geometry>
+std::optional<attribute_span<T>> find_attribute(Geometry& mesh, int location) noexcept
+{
+  static_assert(std::is_same_v<std::remove_cv_t<std::remove_all_extents_t<T>>, float>);
+  constexpr int components = sizeof(T) / sizeof(float);
+
+  auto it = std::find_if(
+      mesh.attributes.begin(),
+      mesh.attributes.end(),
+      [location](const auto& a) { return a.location == location; });
+  if (it == mesh.attributes.end())
+    return std::nullopt;
+
+  if (float_components(it->format) < components)
+    return std::nullopt;
+
+  const int binding = it->binding;
+  if (binding < 0 || binding >= std::ssize(mesh.input))
+    return std::nullopt;
+
+  const auto& input = mesh.input[binding];
+  if (input.buffer < 0 || input.buffer >= std::ssize(mesh.buffers))
+    return std::nullopt;
+
+  const int64_t stride = attribute_stride(mesh, *it);
+
+  const auto& buf = mesh.buffers[input.buffer];
+  const int64_t offset = input.offset + it->offset;
+  if (offset < 0 || offset + int64_t(sizeof(T)) > buf.size)
+    return std::nullopt;
+
+  const int64_t available = (buf.size - offset - int64_t(sizeof(T))) / stride + 1;
+  const int64_t count = std::min(int64_t(mesh.vertices), available);
+
+  using byte_type = std::conditional_t<std::is_const_v<T>, const std::byte, std::byte>;
+  return attribute_span<T>{(byte_type*)buf.data + offset, count, stride};
+}
+}
@@ -0,0 +1,89 @@
+#include "BlobCache.hpp"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <utility>
+
+namespace Threedim
+{
+BlobCache::BlobCache(
+    const QString& name,
+    const QString& suffix,
+    QByteArray magic,
+    int64_t budget)
+    : m_suffix{suffix}
+    , m_magic{std::move(magic)}
+    , m_budget{budget}
+{
+  const QString root = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+  if (!root.isEmpty())
+  {
+    m_directory = root + "/" + name;
+    QDir{}.mkpath(m_directory);
+  }
+}
+
+QString BlobCache::path(const QByteArray& key) const
+{
+  if (m_directory.isEmpty())
+    return {};
+  return m_directory + "/" + QString::fromLatin1(key.toHex()) + m_suffix;
+}
+
+bool BlobCache::read(
+    const QByteArray& key,
+    const std::function<bool(QIODevice&)>& read) const
+{
+  const QString file = path(key);
+  if (file.isEmpty())
+    return false;
+
+  QFile f{file};
+  if (!f.open(QIODevice::ReadOnly))
+    return false;
+  if (f.read(m_magic.size()) != m_magic || !read(f))
+    return false;
+
+  // Files are evicted oldest first: this one was just used
+  f.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+  return true;
+}
+
+void BlobCache::write(
+    const QByteArray& key,
+    const std::function<void(QIODevice&)>& write) const
+{
+  const QString file = path(key);
+  if (file.isEmpty())
+    return;
+
+  // Written to a temporary file first: concurrent readers never see a partial file
+  QSaveFile f{file};
+  if (!f.open(QIODevice::WriteOnly))
+    return;
+
+  f.write(m_magic);
+  write(f);
+  if (f.commit())
+    trim();
+}
+
+void BlobCache::trim() const
+{
+  // Newest first: what comes past the budget is deleted
+  const QFileInfoList files = QDir{m_directory}.entryInfoList(
+      {"*" + m_suffix}, QDir::Files, QDir::Time);
+
+  int64_t bytes = 0;
+  for (const QFileInfo& file : files)
+  {
+    bytes += file.size();
+    if (bytes > m_budget)
+      QFile::remove(file.absoluteFilePath());
+  }
+}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <QByteArray>
+#include <QString>
+
+#include <cstdint>
+#include <functional>
+
+class QIODevice;
+
+namespace Threedim
+{
+/**
+ * @brief Files of a persistent cache, in the user cache directory.
+ *
+ * Each entry is a file named after the hex digest of its key, which starts
+ * with a magic number to bump whenever the layout of the entries changes.
+ * Files are written to a temporary file first, so that concurrent readers
+ * never see a partial one. Once the directory outgrows its budget, the files
+ * which were not used for the longest time are deleted.
+ *
+ * All the functions can be called from any thread.
+ */
+class BlobCache
+{
+public:
+  BlobCache(const QString& name, const QString& suffix, QByteArray magic, int64_t budget);
+
+  //! Empty when there is no cache directory
+  const QString& directory() const noexcept { return m_directory; }
+
+  //! Calls read on the file of key, after its magic. False when read fails.
+  bool read(const QByteArray& key, const std::function<bool(QIODevice&)>& read) const;
+
+  void write(const QByteArray& key, const std::function<void(QIODevice&)>& write) const;
+
+private:
+  QString path(const QByteArray& key) const;
+  // Deletes the oldest files past the budget
+  void trim() const;
+
+  QString m_directory;
+  QString m_suffix;
+  QByteArray m_magic;
+  int64_t m_budget{};
+};
+}
@@ -0,0 +1,179 @@
+#include "BufferPool.hpp"
+
+#include <QDebug>
+#include <QLoggingCategory>
+
+#include <bit>
+#include <new>
+#include <utility>
+
+namespace Threedim
+{
+Q_LOGGING_CATEGORY(threedim_buffers_log, "threedim.buffers", QtWarningMsg)
+
+static constexpr std::align_val_t pooled_buffer_alignment{64};
+static constexpr int pooled_buffer_min_log2 = 12; // 4 kB
+
+PooledBuffer::PooledBuffer(PooledBuffer&& other) noexcept
+    : m_data{std::exchange(other.m_data, nullptr)}
+    , m_size{std::exchange(other.m_size, 0)}
+    , m_class{std::exchange(other.m_class, -1)}
+{
+}
+
+PooledBuffer& PooledBuffer::operator=(PooledBuffer&& other) noexcept
+{
+  if (this != &other)
+  {
+    if (m_data)
+      GeometryBufferPool::instance().release(m_data, m_class);
+    m_data = std::exchange(other.m_data, nullptr);
+    m_size = std::exchange(other.m_size, 0);
+    m_class = std::exchange(other.m_class, -1);
+  }
+  return *this;
+}
+
+PooledBuffer::~PooledBuffer()
+{
+  if (m_data)
+    GeometryBufferPool::instance().release(m_data, m_class);
+}
+
+int64_t PooledBuffer::capacity() const noexcept
+{
+  return m_data ? GeometryBufferPool::class_size(m_class) : 0;
+}
+
+GeometryBufferPool& GeometryBufferPool::instance()
+{
+  // Never destroyed: buffers may still be handed back during static destruction
+  static auto& pool = *new GeometryBufferPool;
+  return pool;
+}
+
+int GeometryBufferPool::size_class(int64_t bytes) noexcept
+{
+  if (bytes <= (int64_t(1) << pooled_buffer_min_log2))
+    return 0;
+
+  // bytes is in (2^k; 2^(k+1)], split this range in four
+  const int k = std::bit_width(uint64_t(bytes - 1)) - 1;
+  const int64_t base = int64_t(1) << k;
+  const int64_t quarter = base >> 2;
+  const int q = int((bytes - base + quarter - 1) / quarter);
+  return (k - pooled_buffer_min_log2) * 4 + q;
+}
+
+int64_t GeometryBufferPool::class_size(int size_class) noexcept
+{
+  const int64_t base = int64_t(1) << (pooled_buffer_min_log2 + size_class / 4);
+  return base + (base >> 2) * (size_class % 4);
+}
+
+PooledBuffer GeometryBufferPool::acquire(int64_t bytes)
+{
+  PooledBuffer buf;
+  if (bytes <= 0)
+    return buf;
+
+  const int c = size_class(bytes);
+  if (c >= num_classes)
+    throw std::bad_alloc{};
+
+  const int64_t capacity = class_size(c);
+  {
+    std::lock_guard lock{m_mutex};
+    if (auto& lst = m_free[c]; !lst.empty())
+    {
+      buf.m_data = lst.back();
+      lst.pop_back();
+      m_freeBytes -= capacity;
+      m_freeBuffers--;
+    }
+  }
+
+  const bool allocated = !buf.m_data;
+  if (allocated)
+    buf.m_data = ::operator new(capacity, pooled_buffer_alignment);
+
+  buf.m_size = bytes;
+  buf.m_class = c;
+  m_usedBytes += capacity;
+  m_usedBuffers++;
+
+  // Recycled buffers do not change the footprint: only the new ones are reported
+  if (allocated && threedim_buffers_log().isDebugEnabled())
+  {
+    const auto s = stats();
+    qCDebug(threedim_buffers_log).nospace()
+        << s.buffers_in_use << " buffers in use (" << s.bytes_in_use / 1024 << " kB), "
+        << s.buffers_free << " free (" << s.bytes_free / 1024 << " kB)";
+  }
+  return buf;
+}
+
+void GeometryBufferPool::resize(PooledBuffer& buffer, int64_t bytes)
+{
+  if (buffer && bytes > 0 && size_class(bytes) == buffer.m_class)
+  {
+    buffer.m_size = bytes;
+    return;
+  }
+
+  buffer = acquire(bytes);
+}
+
+void GeometryBufferPool::release(void* data, int size_class) noexcept
+{
+  const int64_t capacity = class_size(size_class);
+  m_usedBytes -= capacity;
+
+  // The last buffer in use is gone, e.g. the document was closed:
+  // nothing is going to reuse the retained memory soon
+  if (--m_usedBuffers == 0)
+  {
+    ::operator delete(data, pooled_buffer_alignment);
+    trim();
+    return;
+  }
+
+  {
+    std::lock_guard lock{m_mutex};
+    if (m_freeBytes + capacity <= max_retained_bytes)
+    {
+      m_free[size_class].push_back(data);
+      m_freeBytes += capacity;
+      m_freeBuffers++;
+      return;
+    }
+  }
+
+  ::operator delete(data, pooled_buffer_alignment);
+}
+
+void GeometryBufferPool::trim()
+{
+  std::lock_guard lock{m_mutex};
+  for (auto& lst : m_free)
+  {
+    for (void* data : lst)
+      ::operator delete(data, pooled_buffer_alignment);
+    lst.clear();
+  }
+  m_freeBytes = 0;
+  m_freeBuffers = 0;
+}
+
+GeometryBufferPool::statistics GeometryBufferPool::stats() const noexcept
+{
+  statistics s;
+  s.buffers_in_use = m_usedBuffers;
+  s.bytes_in_use = m_usedBytes;
+
+  std::lock_guard lock{m_mutex};
+  s.buffers_free = m_freeBuffers;
+  s.bytes_free = m_freeBytes;
+  return s;
+}
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace Threedim
+{
+class GeometryBufferPool;
+
+/**
+ * @brief Owning handle on a 64-byte aligned geometry buffer.
+ *
+ * The memory goes back to the GeometryBufferPool when the handle is destroyed,
+ * so that it can be reused by the next tick or another node.
+ */
+class PooledBuffer
+{
+public:
+  PooledBuffer() = default;
+  PooledBuffer(const PooledBuffer&) = delete;
+  PooledBuffer& operator=(const PooledBuffer&) = delete;
+  PooledBuffer(PooledBuffer&& other) noexcept;
+  PooledBuffer& operator=(PooledBuffer&& other) noexcept;
+  ~PooledBuffer();
+
+  void* data() const noexcept { return m_data; }
+  //! Requested size, in bytes
+  int64_t size() const noexcept { return m_size; }
+  //! Size of the underlying allocation, in bytes
+  int64_t capacity() const noexcept;
+
+  explicit operator bool() const noexcept { return m_data; }
+
+private:
+  friend class GeometryBufferPool;
+  void* m_data{};
+  int64_t m_size{};
+  int m_class{-1};
+};
+
+/**
+ * @brief Recycles geometry buffers between ticks and between nodes.
+ *
+ * Allocations are rounded up to size classes spaced by a quarter of a power of two
+ * (so at most 25% is wasted), and buffers given back are kept in per-class free lists,
+ * up to a global budget of retained memory. That memory is freed once no buffer is
+ * in use anymore.
+ *
+ * The occupancy is logged on each new allocation, in the threedim.buffers
+ * category: QT_LOGGING_RULES="threedim.buffers.debug=true".
+ */
+class GeometryBufferPool
+{
+public:
+  struct statistics
+  {
+    int64_t buffers_in_use{};
+    int64_t bytes_in_use{};
+    int64_t buffers_free{};
+    int64_t bytes_free{};
+  };
+
+  static GeometryBufferPool& instance();
+
+  //! Memory kept around for reuse beyond this amount is freed immediately
+  static constexpr int64_t max_retained_bytes = 512 * 1024 * 1024;
+
+  PooledBuffer acquire(int64_t bytes);
+
+  //! Keeps the current allocation if it already is in the right size class.
+  //! The contents are not preserved otherwise.
+  void resize(PooledBuffer& buffer, int64_t bytes);
+
+  //! Frees every buffer which is not in use.
+  //! Done automatically when the last buffer in use is released.
+  void trim();
+
+  statistics stats() const noexcept;
+
+  static int size_class(int64_t bytes) noexcept;
+  static int64_t class_size(int size_class) noexcept;
+
+private:
+  friend class PooledBuffer;
+  GeometryBufferPool() = default;
+  ~GeometryBufferPool() = default;
+
+  void release(void* data, int size_class) noexcept;
+
+  static constexpr int num_classes = 4 * 36;
+
+  mutable std::mutex m_mutex;
+  std::array<std::vector<void*>, num_classes> m_free;
+  int64_t m_freeBytes{};
+  int64_t m_freeBuffers{};
+
+  std::atomic_int64_t m_usedBytes{};
+  std::atomic_int64_t m_usedBuffers{};
+};
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <halp/geometry.hpp>
+
+#include <cstdint>
+
+namespace Threedim
+{
+/**
+ * Layout of the per-instance data of instanced meshes.
+ *
+ * The per-instance binding follows the per-vertex ones, and its attributes
+ * come right after the standard locations of halp::dynamic_geometry
+ * (position, tex_coord, color, normal, tangent).
+ */
+struct instance_data
+{
+  //! Column-major, maps the unit primitive to its place in the model
+  float transform[16];
+  float color[4];
+};
+static_assert(sizeof(instance_data) == 80);
+static constexpr int instance_floats = sizeof(instance_data) / sizeof(float);
+
+namespace instance_attribute
+{
+//! Four consecutive locations, one per column of the transform
+static constexpr int transform = 5;
+static constexpr int color = 9;
+}
+}
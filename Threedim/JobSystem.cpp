@@ -0,0 +1,147 @@
+#include "JobSystem.hpp"
+
+#include <QDebug>
+#include <QLoggingCategory>
+
+#include <algorithm>
+
+namespace Threedim
+{
+Q_LOGGING_CATEGORY(threedim_jobs_log, "threedim.jobs", QtWarningMsg)
+
+static constexpr auto job_report_period = std::chrono::seconds(10);
+
+static void job_system_report(const char* name, const JobSystem::statistics& s)
+{
+  qCDebug(threedim_jobs_log).nospace()
+      << name << ": " << s.queued << " queued, " << s.running << " running, " << s.completed
+      << " completed, " << s.coalesced << " coalesced, latency " << s.mean_latency_ms
+      << " ms mean, " << s.max_latency_ms << " ms max";
+}
+
+JobSystem& JobSystem::instance()
+{
+  // Leaves room for the ThreadPool loops started by the jobs
+  static JobSystem jobs{
+      "jobs", std::clamp(int(std::thread::hardware_concurrency()) / 4, 1, 4)};
+  return jobs;
+}
+
+job_priority JobSystem::priority_since(clock::time_point last_tick) noexcept
+{
+  return clock::now() - last_tick < std::chrono::seconds(1) ? job_priority::playing
+                                                            : job_priority::background;
+}
+
+JobSystem::JobSystem(const char* name, int workers)
+    : m_name{name}
+{
+  m_workers.reserve(workers);
+  for (int i = 0; i < workers; i++)
+    m_workers.emplace_back([this] { worker_loop(); });
+}
+
+JobSystem::~JobSystem()
+{
+  {
+    std::lock_guard lock{m_mutex};
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  for (auto& t : m_workers)
+    t.join();
+}
+
+void JobSystem::submit(const void* owner, job_priority priority, std::function<void()> f)
+{
+  {
+    std::lock_guard lock{m_mutex};
+    auto it = owner ? std::find_if(
+                  m_queue.begin(),
+                  m_queue.end(),
+                  [owner](const job& j) { return j.owner == owner; })
+                    : m_queue.end();
+
+    if (it != m_queue.end())
+    {
+      // Keeps its place in the queue
+      it->priority = std::max(it->priority, priority);
+      it->function = std::move(f);
+      m_coalesced++;
+      return;
+    }
+
+    m_queue.push_back(job{
+        .owner = owner,
+        .priority = priority,
+        .submitted = clock::now(),
+        .function = std::move(f)});
+  }
+  m_cv.notify_one();
+}
+
+void JobSystem::worker_loop()
+{
+  for (;;)
+  {
+    job current;
+    {
+      std::unique_lock lock{m_mutex};
+      m_cv.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+      if (m_stop)
+        return;
+
+      // First of the jobs with the highest priority
+      auto it = std::max_element(
+          m_queue.begin(),
+          m_queue.end(),
+          [](const job& a, const job& b) { return a.priority < b.priority; });
+      current = std::move(*it);
+      m_queue.erase(it);
+      m_running++;
+    }
+
+    try
+    {
+      current.function();
+    }
+    catch (...)
+    {
+    }
+
+    const auto done = clock::now();
+    const double latency
+        = std::chrono::duration<double, std::milli>(done - current.submitted).count();
+
+    bool report = false;
+    {
+      std::lock_guard lock{m_mutex};
+      m_running--;
+      m_completed++;
+      m_totalLatency += latency;
+      m_maxLatency = std::max(m_maxLatency, latency);
+
+      if (done - m_lastReport >= job_report_period)
+      {
+        m_lastReport = done;
+        report = threedim_jobs_log().isDebugEnabled();
+      }
+    }
+
+    if (report)
+      job_system_report(m_name, stats());
+  }
+}
+
+JobSystem::statistics JobSystem::stats() const noexcept
+{
+  std::lock_guard lock{m_mutex};
+  return statistics{
+      .queued = int64_t(m_queue.size()),
+      .running = m_running,
+      .completed = m_completed,
+      .coalesced = m_coalesced,
+      .mean_latency_ms = m_completed > 0 ? m_totalLatency / m_completed : 0.,
+      .max_latency_ms = m_maxLatency};
+}
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Threedim
+{
+enum class job_priority : int8_t
+{
+  //! Loading, or nodes which are not running
+  background,
+  //! Nodes which are being executed: their result is displayed right away
+  playing
+};
+
+/**
+ * @brief Fixed set of threads for the background geometry work of all the nodes.
+ *
+ * Jobs are started by priority, then in submission order. A job submitted for
+ * an owner replaces the job of that owner which is still waiting, if any:
+ * a node which gets ten requests while busy only runs the last one.
+ *
+ * The jobs are coarse (parsing a file, building a model...): data-parallel
+ * loops inside of them go through the ThreadPool.
+ *
+ * Work which cannot share the workers of instance() gets its own JobSystem,
+ * such as the Structure Synth builds which have to run one at a time, or the
+ * Model Display shader bakes which must not wait behind geometry jobs.
+ *
+ * stats() is logged every ten seconds while jobs complete, in the
+ * threedim.jobs category: QT_LOGGING_RULES="threedim.jobs.debug=true".
+ */
+class JobSystem
+{
+public:
+  using clock = std::chrono::steady_clock;
+
+  struct statistics
+  {
+    int64_t queued{};
+    int64_t running{};
+    int64_t completed{};
+    //! Jobs replaced by a newer one of the same owner before they started
+    int64_t coalesced{};
+    //! From submission to completion, over the completed jobs
+    double mean_latency_ms{};
+    double max_latency_ms{};
+  };
+
+  static JobSystem& instance();
+
+  //! playing for a node which was executed during the last second, background otherwise
+  static job_priority priority_since(clock::time_point last_tick) noexcept;
+
+  //! name identifies the JobSystem in the logs
+  JobSystem(const char* name, int workers);
+  ~JobSystem();
+
+  //! owner can be null: such jobs are never coalesced
+  void submit(const void* owner, job_priority priority, std::function<void()> job);
+
+  statistics stats() const noexcept;
+
+private:
+  struct job
+  {
+    const void* owner{};
+    job_priority priority{};
+    clock::time_point submitted;
+    std::function<void()> function;
+  };
+
+  void worker_loop();
+
+  mutable std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::deque<job> m_queue;
+  std::vector<std::thread> m_workers;
+  const char* m_name{};
+  bool m_stop{};
+
+  int64_t m_running{};
+  int64_t m_completed{};
+  int64_t m_coalesced{};
+  double m_totalLatency{};
+  double m_maxLatency{};
+  clock::time_point m_lastReport;
+};
+
+/**
+ * @brief Results of a node's jobs, waiting to be applied in its execution thread.
+ *
+ * Jobs hold the mailbox through a shared_ptr, so that a node can be deleted
+ * while its jobs are still running.
+ */
+template <typename Node>
+class job_mailbox
+{
+public:
+  //! Called from the job
+  void post(std::function<void(Node&)> result)
+  {
+    std::lock_guard lock{m_mutex};
+    m_results.push_back(std::move(result));
+  }
+
+  //! Called from the execution thread: applies the results in order, never waits
+  void apply(Node& node)
+  {
+    std::unique_lock lock{m_mutex, std::try_to_lock};
+    if (!lock.owns_lock() || m_results.empty())
+      return;
+
+    std::swap(m_results, m_applying);
+    lock.unlock();
+
+    for (auto& f : m_applying)
+      if (f)
+        f(node);
+    m_applying.clear();
+  }
+
+private:
+  std::mutex m_mutex;
+  std::vector<std::function<void(Node&)>> m_results;
+  std::vector<std::function<void(Node&)>> m_applying;
+};
+}
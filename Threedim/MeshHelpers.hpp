@@ -42,5 +42,7 @@ class TMesh : public vcg::tri::TriMesh<std::vector<TVertex>, std::vector<TFace>>
 {
 };
 
+void meshToBuffer(TMesh& mesh, std::vector<float>& complete);
+void bufferToOutputs(std::vector<float>& complete, PrimitiveOutputs& outputs);
 void loadTriMesh(TMesh& mesh, std::vector<float>& complete, PrimitiveOutputs& outputs);
 }
@@ -1,5 +1,10 @@
 #include "ModelDisplayNode.hpp"
 
+#include "ShaderCache.hpp"
+
+#include <Threedim/Instancing.hpp>
+#include <Threedim/JobSystem.hpp>
+
 #include <Gfx/Graph/GeometryFilterNodeRenderer.hpp>
 #include <Gfx/Graph/NodeRenderer.hpp>
 #include <Gfx/Graph/RenderList.hpp>
@@ -14,6 +19,11 @@
 #include <score/tools/SafeCast.hpp>
 
 #include <QPainter>
+#include <QVarLengthArray>
+
+#include <memory>
+#include <optional>
+#include <unordered_map>
 
 #if defined(near)
 #undef near
@@ -79,6 +89,29 @@ const constexpr auto vtx_output_process_point = R"_(
   gl_PointSize = 1.0f;
 )_";
 
+// Per-instance attributes, with the layout of Threedim/Instancing.hpp.
+// They are applied before the filters, which see the same model as with baked copies.
+static const std::string vtx_define_instance = fmt::format(
+    R"_(
+layout(location = {}) in mat4 instance_transform;
+layout(location = {}) in vec4 instance_color;
+)_",
+    Threedim::instance_attribute::transform,
+    Threedim::instance_attribute::color);
+const constexpr auto vtx_do_instance = R"_(
+  in_position = (instance_transform * vec4(in_position, 1.0)).xyz;
+  in_normal = transpose(inverse(mat3(instance_transform))) * in_normal;
+  if (dot(in_normal, in_normal) > 0.0)
+    in_normal = normalize(in_normal);
+  in_color *= instance_color;
+)_";
+
+// Instanced meshes may only have per-instance colors
+const constexpr auto vtx_define_color = R"_(
+// vec3 float colors get an alpha of 1, unorm8 colors carry their own
+layout(location = 2) in vec4 color;
+)_";
+
 const constexpr auto model_display_vertex_shader_phong = R"_(#version 450
 layout(location = 0) in vec3 position;
 layout(location = 1) in vec2 texcoord;
@@ -94,6 +127,8 @@ layout(binding = 3) uniform sampler2D y_tex;
 
 %vtx_define_filters%
 
+%vtx_define_instance%
+
 %vtx_output%
 
 void main()
@@ -104,6 +139,7 @@ void main()
   vec3 in_tangent = vec3(0);
   vec4 in_color = vec4(1);
 
+  %vtx_do_instance%
   %vtx_do_filters%
 
   esVertex = in_position;
@@ -177,6 +213,8 @@ layout(binding = 3) uniform sampler2D y_tex;
 
 %vtx_define_filters%
 
+%vtx_define_instance%
+
 %vtx_output%
 
 void main()
@@ -187,6 +225,7 @@ void main()
   vec3 in_tangent = vec3(0);
   vec4 in_color = vec4(1);
 
+  %vtx_do_instance%
   %vtx_do_filters%
 
   v_texcoord = in_uv;
@@ -227,6 +266,8 @@ layout(binding = 3) uniform sampler2D y_tex;
 
 %vtx_define_filters%
 
+%vtx_define_instance%
+
 %vtx_output%
 
 void main()
@@ -237,6 +278,7 @@ void main()
   vec3 in_tangent = vec3(0);
   vec4 in_color = vec4(1);
 
+  %vtx_do_instance%
   %vtx_do_filters%
 
   v_normal = in_normal;
@@ -287,6 +329,8 @@ layout(binding = 3) uniform sampler2D y_tex;
 
 %vtx_define_filters%
 
+%vtx_define_instance%
+
 %vtx_output%
 
 void main()
@@ -297,6 +341,7 @@ void main()
   vec3 in_tangent = vec3(0);
   vec4 in_color = vec4(1);
 
+  %vtx_do_instance%
   %vtx_do_filters%
 
   // https://www.clicktorelease.com/blog/creating-spherical-environment-mapping-shader.html
@@ -345,6 +390,8 @@ layout(binding = 3) uniform sampler2D y_tex;
 
 %vtx_define_filters%
 
+%vtx_define_instance%
+
 %vtx_output%
 
 float atan2(in float y, in float x)
@@ -361,6 +408,7 @@ void main()
   vec3 in_tangent = vec3(0);
   vec4 in_color = vec4(1);
 
+  %vtx_do_instance%
   %vtx_do_filters%
 
   // https://www.clicktorelease.com/blog/creating-spherical-environment-mapping-shader.html
@@ -400,6 +448,8 @@ layout(binding = 3) uniform sampler2D y_tex;
 
 %vtx_define_filters%
 
+%vtx_define_instance%
+
 %vtx_output%
 
 void main()
@@ -410,6 +460,7 @@ void main()
   vec3 in_tangent = vec3(0);
   vec4 in_color = vec4(1);
 
+  %vtx_do_instance%
   %vtx_do_filters%
 
   gl_Position = renderer.clipSpaceCorrMatrix * mat.matrixModelViewProjection * vec4(in_position.xyz, 1.0);
@@ -442,6 +493,8 @@ layout(binding = 3) uniform sampler2D y_tex;
 
 %vtx_define_filters%
 
+%vtx_define_instance%
+
 %vtx_output%
 
 void main()
@@ -452,6 +505,7 @@ void main()
   vec3 in_tangent = vec3(0);
   vec4 in_color = vec4(1);
 
+  %vtx_do_instance%
   %vtx_do_filters%
 
   if(gl_VertexIndex % 3 == 0) v_bary = vec2(0, 0);
@@ -480,14 +534,16 @@ void main ()
 
 const constexpr auto model_display_vertex_shader_color = R"_(#version 450
 layout(location = 0) in vec3 position;
-layout(location = 2) in vec3 color;
+%vtx_define_color%
 
-layout(location = 0) out vec3 v_color;
+layout(location = 0) out vec4 v_color;
 
 )_" model_display_default_uniforms R"_(
 
 %vtx_define_filters%
 
+%vtx_define_instance%
+
 %vtx_output%
 
 void main()
@@ -496,11 +552,12 @@ void main()
   vec3 in_normal = vec3(0);
   vec2 in_uv = vec2(0);
   vec3 in_tangent = vec3(0);
-  vec4 in_color = vec4(color.rgb, 1.);
+  vec4 in_color = %vtx_color%;
 
+  %vtx_do_instance%
   %vtx_do_filters%
 
-  v_color = in_color.rgb;
+  v_color = in_color;
   gl_Position = renderer.clipSpaceCorrMatrix * mat.matrixModelViewProjection * vec4(in_position.xyz, 1.0);
 
   %vtx_output_process%
@@ -511,13 +568,12 @@ const constexpr auto model_display_fragment_shader_color = R"_(#version 450
 
 )_" model_display_default_uniforms R"_(
 
-layout(location = 0) in vec3 v_color;
+layout(location = 0) in vec4 v_color;
 layout(location = 0) out vec4 fragColor;
 
 void main ()
 {
-  fragColor.rgb = v_color;
-  fragColor.a = 1.;
+  fragColor = v_color;
 }
 )_";
 
@@ -536,23 +592,63 @@ ModelDisplayNode::~ModelDisplayNode()
   m_materialData.release();
 }
 
+// Shaders are baked on their own thread: the workers of JobSystem::instance()
+// may all be busy with long geometry jobs, and a node without its shaders
+// draws nothing
+static Threedim::JobSystem& model_display_bakes()
+{
+  static Threedim::JobSystem bakes{"model display shaders", 1};
+  return bakes;
+}
+
 #include <Gfx/Qt5CompatPush> // clang-format: keep
 class ModelDisplayNode::Renderer : public GenericNodeRenderer
 {
 public:
   using GenericNodeRenderer::GenericNodeRenderer;
 
-  struct RenderShaders
+  //! The shader programs, each is compiled only once needed
+  enum Program : uint8_t
+  {
+    Phong,
+    TexCoord,
+    Triplanar,
+    Spherical,
+    Spherical2,
+    Viewspace,
+    Barycentric,
+    Color
+  };
+
+  struct ShaderKey
+  {
+    Program program{};
+    bool points{};
+    bool instanced{};
+    //! Per-vertex colors, only used by the Color program
+    bool colors{};
+    bool operator==(const ShaderKey&) const noexcept = default;
+  };
+  struct ShaderKeyHash
+  {
+    std::size_t operator()(const ShaderKey& k) const noexcept
+    {
+      return ((std::size_t(k.program) * 2 + k.points) * 2 + k.instanced) * 2 + k.colors;
+    }
+  };
+
+  //! Everything a pipeline depends on, besides the buffers of the node itself
+  struct PipelineKey
   {
-    QShader phongVS, phongFS;
-    QShader texCoordVS, texCoordFS;
-    QShader triplanarVS, triplanarFS;
-    QShader sphericalVS, sphericalFS;
-    QShader spherical2VS, spherical2FS;
-    QShader viewspaceVS, viewspaceFS;
-    QShader barycentricVS, barycentricFS;
-    QShader colorVS, colorFS;
-  } triangle, point;
+    ShaderKey shaders;
+    QRhiGraphicsPipeline::Topology topology{};
+    QRhiVertexInputLayout layout;
+    QRhiRenderTarget* target{};
+    QRhiRenderPassDescriptor* renderPass{};
+    //! Uniforms of the geometry filters
+    std::vector<QRhiBuffer*> filters;
+    bool operator==(const PipelineKey&) const noexcept = default;
+  };
 
   int m_curShader{0};
   int m_draw_mode{0};
@@ -564,21 +660,52 @@ private:
   ~Renderer() = default;
 
   score::gfx::TextureRenderTarget m_inputTarget;
+
+  std::unordered_map<ShaderKey, std::pair<QShader, QShader>, ShaderKeyHash> m_shaders;
+  std::size_t m_shadersFilters{};
+
+  // Owns the pipelines of m_p: switching between projections and draw modes
+  // which were already used does not create anything
+  std::vector<std::pair<PipelineKey, Pipeline>> m_pipelines;
+
+  // Shaders which are not cached yet are compiled in model_display_bakes():
+  // until they are ready, the current passes keep drawing
+  std::shared_ptr<Threedim::job_mailbox<Renderer>> m_jobs
+      = std::make_shared<Threedim::job_mailbox<Renderer>>();
+  std::optional<ShaderKey> m_pendingShaders;
+  bool m_passesDirty{};
+  QRhiVertexInputLayout m_passesLayout;
+
+  //! A mesh of the input after the first one, with its own buffers
+  struct Batch
+  {
+    std::size_t mesh{};
+    std::vector<QRhiBuffer*> buffers;
+  };
+  std::vector<Batch> m_batches;
+
   TextureRenderTarget renderTargetForInput(const Port& p) override
   {
     return m_inputTarget;
   }
 
-  void initPasses_impl(RenderList& renderer, const Mesh& mesh, RenderShaders& shaders)
+  QString processVertexShader(
+      QString init,
+      std::string_view out,
+      std::string_view proc,
+      const ShaderKey& key,
+      const score::gfx::Mesh& mesh)
   {
-    auto& n = (ModelDisplayNode&)node;
-    bool has_texcoord = mesh.flags() & Mesh::HasTexCoord;
-    bool has_normals = mesh.flags() & Mesh::HasNormals;
-    bool has_colors = mesh.flags() & Mesh::HasColor;
 
+    std::string vtx_define_filters;
+    std::string vtx_do_filters;
+    // Add additional bindings.
+    // 0: renderer
+    // 1: processUBO
+    // 2: materialUBO
+    // 3: input texture
+    // 4: it starts here :)
     int cur_binding = 4;
-    std::vector<QRhiBuffer*> ubos;
-    std::vector<QRhiShaderResourceBinding> additional_bindings;
 
     if (mesh.filters)
     {
@@ -586,259 +713,271 @@ private:
       {
         for (auto& f : mesh.filters->filters)
         {
-          for (auto n : renderer.renderers)
-          {
-            if (n->id == f.node_id)
-            {
-              if (auto c = safe_cast<score::gfx::GeometryFilterNodeRenderer*>(n))
-              {
-                additional_bindings.push_back(QRhiShaderResourceBinding::uniformBuffer(
-                    cur_binding, QRhiShaderResourceBinding::VertexStage, c->material()));
-
-                cur_binding++;
-                break;
-              }
-            }
-          }
+          auto shader = f.shader;
+          boost::algorithm::replace_first(
+              shader, "%next%", std::to_string(cur_binding++));
+          vtx_define_filters += shader;
+          vtx_do_filters += fmt::format(
+              "process_vertex_{}(in_position, in_normal, in_uv, in_tangent, "
+              "in_color);",
+              f.filter_id);
         }
       }
     }
 
-    if (has_colors && n.wantedProjection == 7)
+    init.replace("%vtx_define_filters%", vtx_define_filters.data());
+    init.replace("%vtx_do_filters%", vtx_do_filters.data());
+    init.replace("%vtx_define_instance%", key.instanced ? vtx_define_instance.data() : "");
+    init.replace("%vtx_do_instance%", key.instanced ? vtx_do_instance : "");
+    init.replace("%vtx_define_color%", key.colors ? vtx_define_color : "");
+    init.replace("%vtx_color%", key.colors ? "color" : "vec4(1)");
+    init.replace("%vtx_output%", out.data());
+    init.replace("%vtx_output_process%", proc.data());
+    return init;
+  }
+
+  // Which program renders the wanted projection, given the attributes of the mesh
+  static Program programForProjection(
+      int projection,
+      bool has_texcoord,
+      bool has_normals,
+      bool has_colors) noexcept
+  {
+    if (has_colors && projection == 7)
+      return Color;
+
+    switch (projection)
     {
-      defaultPassesInit(
-          renderer, mesh, shaders.colorVS, shaders.colorFS, additional_bindings);
-      return;
+      case 4: // Needs just position
+        return Viewspace;
+      case 5: // Needs just position
+        return Barycentric;
     }
 
     if (has_texcoord && has_normals)
     {
-      switch (n.wantedProjection)
+      switch (projection)
       {
         default:
         case 0: // Needs TCoord
-          defaultPassesInit(
-              renderer,
-              mesh,
-              shaders.texCoordVS,
-              shaders.texCoordFS,
-              additional_bindings);
-          break;
+          return TexCoord;
         case 1: // Needs Normals
-          defaultPassesInit(
-              renderer,
-              mesh,
-              shaders.triplanarVS,
-              shaders.triplanarFS,
-              additional_bindings);
-          break;
+          return Triplanar;
         case 2: // Needs Normals
-          defaultPassesInit(
-              renderer,
-              mesh,
-              shaders.sphericalVS,
-              shaders.sphericalFS,
-              additional_bindings);
-          break;
+          return Spherical;
         case 3: // Needs Normals
-          defaultPassesInit(
-              renderer,
-              mesh,
-              shaders.spherical2VS,
-              shaders.spherical2FS,
-              additional_bindings);
-          break;
-        case 4: // Needs just position
-          defaultPassesInit(
-              renderer,
-              mesh,
-              shaders.viewspaceVS,
-              shaders.viewspaceFS,
-              additional_bindings);
-          break;
-        case 5: // Needs just position
-          defaultPassesInit(
-              renderer,
-              mesh,
-              shaders.barycentricVS,
-              shaders.barycentricFS,
-              additional_bindings);
-          break;
+          return Spherical2;
         case 6: // Needs TCoord + Normals
-          defaultPassesInit(
-              renderer, mesh, shaders.phongVS, shaders.phongFS, additional_bindings);
-          break;
+          return Phong;
       }
     }
-    else if (has_texcoord && !has_normals)
+    else if (has_texcoord)
     {
-      switch (n.wantedProjection)
-      {
-        default:
-        case 0:
-        case 1:
-        case 2:
-        case 3:
-        case 6:
-          defaultPassesInit(
-              renderer,
-              mesh,
-              shaders.texCoordVS,
-              shaders.texCoordFS,
-              additional_bindings);
-          break;
-        case 4: // Needs just position
-          defaultPassesInit(
-              renderer,
-              mesh,
-              shaders.viewspaceVS,
-              shaders.viewspaceFS,
-              additional_bindings);
-          break;
-        case 5: // Needs just position
-          defaultPassesInit(
-              renderer,
-              mesh,
-              shaders.barycentricVS,
-              shaders.barycentricFS,
-              additional_bindings);
-          break;
-      }
+      return TexCoord;
     }
-    else if (has_normals && !has_texcoord)
+    else if (has_normals)
     {
-      switch (n.wantedProjection)
+      switch (projection)
       {
         default:
-        case 0:
-        case 6:
         case 1: // Needs Normals
-          defaultPassesInit(
-              renderer,
-              mesh,
-              shaders.triplanarVS,
-              shaders.triplanarFS,
-              additional_bindings);
-          break;
+          return Triplanar;
         case 2: // Needs Normals
-          defaultPassesInit(
-              renderer,
-              mesh,
-              shaders.sphericalVS,
-              shaders.sphericalFS,
-              additional_bindings);
-          break;
+          return Spherical;
         case 3: // Needs Normals
-          defaultPassesInit(
-              renderer,
-              mesh,
-              shaders.spherical2VS,
-              shaders.spherical2FS,
-              additional_bindings);
-          break;
-        case 4: // Needs just position
-          defaultPassesInit(
-              renderer,
-              mesh,
-              shaders.viewspaceVS,
-              shaders.viewspaceFS,
-              additional_bindings);
-          break;
-        case 5: // Needs just position
-          defaultPassesInit(
-              renderer,
-              mesh,
-              shaders.barycentricVS,
-              shaders.barycentricFS,
-              additional_bindings);
-          break;
+          return Spherical2;
       }
     }
-    else if (!has_texcoord && !has_normals)
+    return Viewspace;
+  }
+
+  static std::pair<const char*, const char*> programSources(Program p) noexcept
+  {
+    switch (p)
     {
-      switch (n.wantedProjection)
+      case Phong:
+        return {model_display_vertex_shader_phong, model_display_fragment_shader_phong};
+      case TexCoord:
+        return {
+            model_display_vertex_shader_texcoord, model_display_fragment_shader_texcoord};
+      case Triplanar:
+        return {
+            model_display_vertex_shader_triplanar,
+            model_display_fragment_shader_triplanar};
+      case Spherical:
+        return {
+            model_display_vertex_shader_spherical,
+            model_display_fragment_shader_spherical};
+      case Spherical2:
+        return {
+            model_display_vertex_shader_spherical2,
+            model_display_fragment_shader_spherical2};
+      default:
+      case Viewspace:
+        return {
+            model_display_vertex_shader_viewspace,
+            model_display_fragment_shader_viewspace};
+      case Barycentric:
+        return {
+            model_display_vertex_shader_barycentric,
+            model_display_fragment_shader_barycentric};
+      case Color:
+        return {model_display_vertex_shader_color, model_display_fragment_shader_color};
+    }
+  }
+
+  // The geometry filters are inlined in the vertex shaders
+  static std::size_t filtersHash(const score::gfx::Mesh& mesh)
+  {
+    std::string filters;
+    if (mesh.filters)
+    {
+      for (auto& f : mesh.filters->filters)
       {
-        default:
-        case 0:
-        case 1:
-        case 2:
-        case 3:
-        case 6:
-        case 4: // Needs just position
-          defaultPassesInit(
-              renderer,
-              mesh,
-              shaders.viewspaceVS,
-              shaders.viewspaceFS,
-              additional_bindings);
-          break;
-        case 5: // Needs just position
-          defaultPassesInit(
-              renderer,
-              mesh,
-              shaders.barycentricVS,
-              shaders.barycentricFS,
-              additional_bindings);
-          break;
+        filters += f.shader;
+        filters += fmt::format("\n{}\n", f.filter_id);
       }
     }
+    return std::hash<std::string>{}(filters);
   }
 
-  void initPasses(RenderList& renderer, const Mesh& mesh)
+  // Compiled shaders and pipelines are only valid for the current filters
+  void checkFilters(const score::gfx::Mesh& mesh)
   {
-    auto& n = (ModelDisplayNode&)node;
-
-    createShaders(renderer, mesh);
-    m_curShader = n.wantedProjection;
-    m_draw_mode = n.draw_mode;
-    switch (m_draw_mode)
+    if (const auto filters = filtersHash(mesh); filters != m_shadersFilters)
     {
-      case 0:
-        initPasses_impl(renderer, mesh, triangle);
-        for (auto& [e, pass] : this->m_p)
-        {
-          pass.pipeline->destroy();
-          pass.pipeline->setTopology(QRhiGraphicsPipeline::Triangles);
-          pass.pipeline->create();
-        }
-        break;
-      case 1:
-        initPasses_impl(renderer, mesh, point);
-        for (auto& [e, pass] : this->m_p)
-        {
-          pass.pipeline->destroy();
-          pass.pipeline->setTopology(QRhiGraphicsPipeline::Points);
-          pass.pipeline->create();
-        }
-        break;
-      case 2:
-        initPasses_impl(renderer, mesh, triangle);
-        for (auto& [e, pass] : this->m_p)
+      // The passes use the uniforms of the filters
+      m_p.clear();
+      releasePipelines();
+      m_shaders.clear();
+      m_pendingShaders.reset();
+      m_shadersFilters = filters;
+    }
+  }
+
+  // nullptr while the shaders are being compiled
+  const std::pair<QShader, QShader>*
+  shaders(RenderList& renderer, const score::gfx::Mesh& mesh, ShaderKey key)
+  {
+    if (auto it = m_shaders.find(key); it != m_shaders.end())
+      return &it->second;
+    if (m_pendingShaders == key)
+      return nullptr;
+
+    const auto [vertex, fragment] = programSources(key.program);
+    const QString vs
+        = key.points
+              ? processVertexShader(
+                  vertex,
+                  vtx_output_point,
+                  vtx_output_process_point,
+                  key,
+                  mesh)
+              : processVertexShader(
+                  vertex,
+                  vtx_output_triangle,
+                  vtx_output_process_triangle,
+                  key,
+                  mesh);
+
+    // Already baked for another node
+    if (std::pair<QShader, QShader> res;
+        ModelDisplayShaderCache::instance().find(
+            ModelDisplayShaderTarget::of(renderer.state), vs, fragment, res))
+      return &m_shaders.emplace(key, std::move(res)).first->second;
+
+    m_pendingShaders = key;
+    model_display_bakes().submit(
+        m_jobs.get(),
+        Threedim::job_priority::playing,
+        [jobs = m_jobs,
+         // Only what the baking depends on: the jobs may outlive the renderer
+         target = ModelDisplayShaderTarget::of(renderer.state),
+         key,
+         filters = m_shadersFilters,
+         vs,
+         fs = QString{fragment}]
         {
-          pass.pipeline->destroy();
-          pass.pipeline->setTopology(QRhiGraphicsPipeline::Lines);
-          pass.pipeline->create();
-        }
-        break;
+          // This part happens in a JobSystem thread
+          // Invalid shaders if compilation fails: nothing gets drawn
+          auto res = ModelDisplayShaderCache::instance().shaders(target, vs, fs);
+
+          jobs->post(
+              [key, filters, res = std::move(res)](Renderer& r)
+              {
+                // Compiled for filters which were replaced since
+                if (filters != r.m_shadersFilters)
+                  return;
+                r.m_shaders.emplace(key, res);
+                if (r.m_pendingShaders == key)
+                  r.m_pendingShaders.reset();
+                r.m_passesDirty = true;
+              });
+        });
+    return nullptr;
+  }
+
+  static QRhiVertexInputLayout vertexLayout(QRhi& rhi, const score::gfx::Mesh& mesh)
+  {
+    std::unique_ptr<QRhiGraphicsPipeline> probe{rhi.newGraphicsPipeline()};
+    mesh.preparePipeline(*probe);
+    return probe->vertexInputLayout();
+  }
+
+  Pipeline pipeline(
+      RenderList& renderer,
+      const score::gfx::Mesh& mesh,
+      const TextureRenderTarget& rt,
+      const std::pair<QShader, QShader>& shaders,
+      PipelineKey key,
+      std::span<QRhiShaderResourceBinding> additional_bindings)
+  {
+    for (auto& [k, p] : m_pipelines)
+      if (k == key)
+        return p;
+
+    const auto& [vs, fs] = shaders;
+    auto p = score::gfx::buildPipeline(
+        renderer,
+        mesh,
+        vs,
+        fs,
+        rt,
+        m_processUBO,
+        m_material.buffer,
+        m_samplers,
+        additional_bindings);
+    if (p.pipeline->topology() != key.topology)
+    {
+      p.pipeline->destroy();
+      p.pipeline->setTopology(key.topology);
+      p.pipeline->create();
     }
+
+    m_pipelines.emplace_back(std::move(key), p);
+    return p;
   }
 
-  QString processVertexShader(
-      QString init,
-      std::string_view out,
-      std::string_view proc,
-      const score::gfx::Mesh& mesh)
+  void releasePipelines()
   {
+    for (auto& [k, p] : m_pipelines)
+      p.release();
+    m_pipelines.clear();
+  }
+
+  void initPasses_impl(
+      RenderList& renderer,
+      const Mesh& mesh,
+      QRhiGraphicsPipeline::Topology topology)
+  {
+    auto& n = (ModelDisplayNode&)node;
+    bool has_texcoord = mesh.flags() & Mesh::HasTexCoord;
+    bool has_normals = mesh.flags() & Mesh::HasNormals;
+    bool has_colors = mesh.flags() & Mesh::HasColor;
 
-    std::string vtx_define_filters;
-    std::string vtx_do_filters;
-    // Add additional bindings.
-    // 0: renderer
-    // 1: processUBO
-    // 2: materialUBO
-    // 3: input texture
-    // 4: it starts here :)
     int cur_binding = 4;
+    std::vector<QRhiBuffer*> ubos;
+    std::vector<QRhiShaderResourceBinding> additional_bindings;
 
     if (mesh.filters)
     {
@@ -846,145 +985,101 @@ private:
       {
         for (auto& f : mesh.filters->filters)
         {
-          auto shader = f.shader;
-          boost::algorithm::replace_first(
-              shader, "%next%", std::to_string(cur_binding++));
-          vtx_define_filters += shader;
-          vtx_do_filters += fmt::format(
-              "process_vertex_{}(in_position, in_normal, in_uv, in_tangent, "
-              "in_color);",
-              f.filter_id);
+          for (auto n : renderer.renderers)
+          {
+            if (n->id == f.node_id)
+            {
+              if (auto c = safe_cast<score::gfx::GeometryFilterNodeRenderer*>(n))
+              {
+                additional_bindings.push_back(QRhiShaderResourceBinding::uniformBuffer(
+                    cur_binding, QRhiShaderResourceBinding::VertexStage, c->material()));
+                ubos.push_back(c->material());
+
+                cur_binding++;
+                break;
+              }
+            }
+          }
         }
       }
     }
 
-    init.replace("%vtx_define_filters%", vtx_define_filters.data());
-    init.replace("%vtx_do_filters%", vtx_do_filters.data());
-    init.replace("%vtx_output%", out.data());
-    init.replace("%vtx_output_process%", proc.data());
-    return init;
+    const bool instanced = instanceCount() > 0;
+    const auto program = programForProjection(
+        n.wantedProjection, has_texcoord, has_normals, has_colors || instanced);
+    const ShaderKey shaderKey{
+        program, topology == QRhiGraphicsPipeline::Points, instanced, has_colors};
+    const auto layout = vertexLayout(*renderer.state.rhi, mesh);
+
+    const auto* shaders = this->shaders(renderer, mesh, shaderKey);
+    if (!shaders)
+    {
+      // The current passes cannot draw a mesh with another layout
+      if (layout != m_passesLayout)
+        m_p.clear();
+      m_passesDirty = true;
+      return;
+    }
+
+    m_p.clear();
+    m_passesDirty = false;
+    m_passesLayout = layout;
+    if (!shaders->first.isValid() || !shaders->second.isValid())
+      return;
+
+    std::vector<QRhiRenderTarget*> targets;
+    for (Edge* edge : this->node.output[0]->edges)
+    {
+      auto rt = renderer.renderTargetForOutput(*edge);
+      if (rt.renderTarget)
+      {
+        m_p.emplace_back(
+            edge,
+            pipeline(
+                renderer,
+                mesh,
+                rt,
+                *shaders,
+                {shaderKey, topology, layout, rt.renderTarget, rt.renderPass, ubos},
+                additional_bindings));
+        targets.push_back(rt.renderTarget);
+      }
+    }
+
+    // Render targets which are not drawn to anymore may be deleted
+    std::erase_if(
+        m_pipelines,
+        [&](auto& e)
+        {
+          if (std::find(targets.begin(), targets.end(), e.first.target)
+              != targets.end())
+            return false;
+          e.second.release();
+          return true;
+        });
   }
 
-  void createShaders(RenderList& renderer, const score::gfx::Mesh& mesh)
+  void initPasses(RenderList& renderer, const Mesh& mesh)
   {
-    const QString triangle_phongVS = processVertexShader(
-        model_display_vertex_shader_phong,
-        vtx_output_triangle,
-        vtx_output_process_triangle,
-        mesh);
-    const QString triangle_texcoordVS = processVertexShader(
-        model_display_vertex_shader_texcoord,
-        vtx_output_triangle,
-        vtx_output_process_triangle,
-        mesh);
-    const QString triangle_triplanarVS = processVertexShader(
-        model_display_vertex_shader_triplanar,
-        vtx_output_triangle,
-        vtx_output_process_triangle,
-        mesh);
-    const QString triangle_sphericalVS = processVertexShader(
-        model_display_vertex_shader_spherical,
-        vtx_output_triangle,
-        vtx_output_process_triangle,
-        mesh);
-    const QString triangle_spherical2VS = processVertexShader(
-        model_display_vertex_shader_spherical2,
-        vtx_output_triangle,
-        vtx_output_process_triangle,
-        mesh);
-    const QString triangle_viewspaceVS = processVertexShader(
-        model_display_vertex_shader_viewspace,
-        vtx_output_triangle,
-        vtx_output_process_triangle,
-        mesh);
-    const QString triangle_barycentricVS = processVertexShader(
-        model_display_vertex_shader_barycentric,
-        vtx_output_triangle,
-        vtx_output_process_triangle,
-        mesh);
-    const QString triangle_colorVS = processVertexShader(
-        model_display_vertex_shader_color,
-        vtx_output_triangle,
-        vtx_output_process_triangle,
-        mesh);
-
-    std::tie(triangle.phongVS, triangle.phongFS) = score::gfx::makeShaders(
-        renderer.state, triangle_phongVS, model_display_fragment_shader_phong);
-    std::tie(triangle.texCoordVS, triangle.texCoordFS) = score::gfx::makeShaders(
-        renderer.state, triangle_texcoordVS, model_display_fragment_shader_texcoord);
-    std::tie(triangle.triplanarVS, triangle.triplanarFS) = score::gfx::makeShaders(
-        renderer.state, triangle_triplanarVS, model_display_fragment_shader_triplanar);
-    std::tie(triangle.sphericalVS, triangle.sphericalFS) = score::gfx::makeShaders(
-        renderer.state, triangle_sphericalVS, model_display_fragment_shader_spherical);
-    std::tie(triangle.spherical2VS, triangle.spherical2FS) = score::gfx::makeShaders(
-        renderer.state, triangle_spherical2VS, model_display_fragment_shader_spherical2);
-    std::tie(triangle.viewspaceVS, triangle.viewspaceFS) = score::gfx::makeShaders(
-        renderer.state, triangle_viewspaceVS, model_display_fragment_shader_viewspace);
-    std::tie(triangle.barycentricVS, triangle.barycentricFS) = score::gfx::makeShaders(
-        renderer.state,
-        triangle_barycentricVS,
-        model_display_fragment_shader_barycentric);
-    std::tie(triangle.colorVS, triangle.colorFS) = score::gfx::makeShaders(
-        renderer.state, triangle_colorVS, model_display_fragment_shader_color);
-
-    const QString point_phongVS = processVertexShader(
-        model_display_vertex_shader_phong,
-        vtx_output_point,
-        vtx_output_process_point,
-        mesh);
-    const QString point_texcoordVS = processVertexShader(
-        model_display_vertex_shader_texcoord,
-        vtx_output_point,
-        vtx_output_process_point,
-        mesh);
-    const QString point_triplanarVS = processVertexShader(
-        model_display_vertex_shader_triplanar,
-        vtx_output_point,
-        vtx_output_process_point,
-        mesh);
-    const QString point_sphericalVS = processVertexShader(
-        model_display_vertex_shader_spherical,
-        vtx_output_point,
-        vtx_output_process_point,
-        mesh);
-    const QString point_spherical2VS = processVertexShader(
-        model_display_vertex_shader_spherical2,
-        vtx_output_point,
-        vtx_output_process_point,
-        mesh);
-    const QString point_viewspaceVS = processVertexShader(
-        model_display_vertex_shader_viewspace,
-        vtx_output_point,
-        vtx_output_process_point,
-        mesh);
-    const QString point_barycentricVS = processVertexShader(
-        model_display_vertex_shader_barycentric,
-        vtx_output_point,
-        vtx_output_process_point,
-        mesh);
-    const QString point_colorVS = processVertexShader(
-        model_display_vertex_shader_color,
-        vtx_output_point,
-        vtx_output_process_point,
-        mesh);
-
-    std::tie(point.phongVS, point.phongFS) = score::gfx::makeShaders(
-        renderer.state, point_phongVS, model_display_fragment_shader_phong);
-    std::tie(point.texCoordVS, point.texCoordFS) = score::gfx::makeShaders(
-        renderer.state, point_texcoordVS, model_display_fragment_shader_texcoord);
-    std::tie(point.triplanarVS, point.triplanarFS) = score::gfx::makeShaders(
-        renderer.state, point_triplanarVS, model_display_fragment_shader_triplanar);
-    std::tie(point.sphericalVS, point.sphericalFS) = score::gfx::makeShaders(
-        renderer.state, point_sphericalVS, model_display_fragment_shader_spherical);
-    std::tie(point.spherical2VS, point.spherical2FS) = score::gfx::makeShaders(
-        renderer.state, point_spherical2VS, model_display_fragment_shader_spherical2);
-    std::tie(point.viewspaceVS, point.viewspaceFS) = score::gfx::makeShaders(
-        renderer.state, point_viewspaceVS, model_display_fragment_shader_viewspace);
-    std::tie(point.barycentricVS, point.barycentricFS) = score::gfx::makeShaders(
-        renderer.state, point_barycentricVS, model_display_fragment_shader_barycentric);
-    std::tie(point.colorVS, point.colorFS) = score::gfx::makeShaders(
-        renderer.state, point_colorVS, model_display_fragment_shader_color);
+    auto& n = (ModelDisplayNode&)node;
+
+    checkFilters(mesh);
+    m_curShader = n.wantedProjection;
+    m_draw_mode = n.draw_mode;
+    switch (m_draw_mode)
+    {
+      case 0:
+        initPasses_impl(renderer, mesh, QRhiGraphicsPipeline::Triangles);
+        break;
+      case 1:
+        initPasses_impl(renderer, mesh, QRhiGraphicsPipeline::Points);
+        break;
+      case 2:
+        initPasses_impl(renderer, mesh, QRhiGraphicsPipeline::Lines);
+        break;
+    }
   }
+
   void init(RenderList& renderer, QRhiResourceUpdateBatch& res) override
   {
     auto& rhi = *renderer.state.rhi;
@@ -1014,6 +1109,7 @@ private:
     processUBOInit(renderer);
     m_material.init(renderer, node.input, m_samplers);
 
+    ModelDisplayShaderCache::instance().restorePipelines(*renderer.state.rhi);
     initPasses(renderer, mesh);
   }
 
@@ -1076,6 +1172,7 @@ private:
     res.updateDynamicBuffer(
         m_processUBO, 0, sizeof(ProcessUBO), &this->node.standardUBO);
 
+    bool geometryChanged = false;
     if (node.hasGeometryChanged(geometryChangedIndex))
     {
       if (node.geometry.meshes)
@@ -1084,35 +1181,266 @@ private:
         SCORE_ASSERT(m_mesh);
         this->meshChangedIndex = this->m_mesh->dirtyGeometryIndex;
       }
-      mustRecreatePasses = true;
+      geometryChanged = true;
     }
 
     const auto& mesh = m_mesh ? *m_mesh : renderer.defaultQuad();
     if (mesh.hasGeometryChanged(meshChangedIndex))
-      mustRecreatePasses = true;
+      geometryChanged = true;
 
-    if (mustRecreatePasses)
+    if (geometryChanged)
     {
-      for (auto& pass : m_p)
-        pass.second.release();
-      m_p.clear();
+      uploadBatches(renderer, res);
+      mustRecreatePasses = true;
+    }
 
-      const auto& mesh = m_mesh ? *m_mesh : renderer.defaultQuad();
+    m_jobs->apply(*this);
+    if (mustRecreatePasses || m_passesDirty)
       initPasses(renderer, mesh);
-    }
 
     res.generateMips(this->m_inputTarget.texture);
   }
 
+  // The incoming geometry, drawn with the pipelines of the passes
+  const ossia::geometry* geometry() const noexcept
+  {
+    if (!m_mesh || !node.geometry.meshes || node.geometry.meshes->meshes.empty())
+      return nullptr;
+    return &node.geometry.meshes->meshes[0];
+  }
+
+  // Number of instances of a geometry, 0 when it has no per-instance transform
+  static int64_t instanceCount(const ossia::geometry& geom) noexcept
+  {
+    for (const auto& attr : geom.attributes)
+    {
+      if (int(attr.location) != Threedim::instance_attribute::transform)
+        continue;
+      if (attr.binding < 0 || attr.binding >= std::ssize(geom.bindings)
+          || attr.binding >= std::ssize(geom.input))
+        return 0;
+
+      const auto& binding = geom.bindings[attr.binding];
+      if (binding.classification != decltype(binding.classification)::per_instance
+          || binding.stride == 0)
+        return 0;
+
+      // Never more than what the per-instance buffer holds
+      const auto& in = geom.input[attr.binding];
+      if (in.buffer < 0 || in.buffer >= std::ssize(geom.buffers))
+        return 0;
+      const int64_t stored
+          = (geom.buffers[in.buffer].size - in.byte_offset) / binding.stride;
+      return std::max(std::min(int64_t(geom.instances), stored), int64_t(0));
+    }
+    return 0;
+  }
+
+  int64_t instanceCount() const noexcept
+  {
+    const auto* geom = geometry();
+    return geom ? instanceCount(*geom) : 0;
+  }
+
+  // The other meshes of the input can be drawn with the pipelines of the first
+  // one when they have the same layout, such as the parts of an instanced
+  // Structure Synth model
+  static bool sameLayout(const ossia::geometry& a, const ossia::geometry& b) noexcept
+  {
+    if (a.topology != b.topology || a.bindings.size() != b.bindings.size()
+        || a.attributes.size() != b.attributes.size() || a.input.size() != b.input.size())
+      return false;
+
+    for (std::size_t i = 0; i < a.bindings.size(); i++)
+    {
+      const auto& x = a.bindings[i];
+      const auto& y = b.bindings[i];
+      if (x.stride != y.stride || x.classification != y.classification)
+        return false;
+    }
+    for (std::size_t i = 0; i < a.attributes.size(); i++)
+    {
+      const auto& x = a.attributes[i];
+      const auto& y = b.attributes[i];
+      if (x.binding != y.binding || x.location != y.location || x.format != y.format
+          || x.byte_offset != y.byte_offset)
+        return false;
+    }
+    return true;
+  }
+
+  static const void* bufferData(const void* data) noexcept { return data; }
+  template <typename Ptr>
+  static const void* bufferData(const Ptr& data) noexcept
+  {
+    return data.get();
+  }
+
+  // score uploads the buffers of the first mesh of the input only: those of the
+  // other meshes are uploaded here
+  void uploadBatches(RenderList& renderer, QRhiResourceUpdateBatch& res)
+  {
+    releaseBatches();
+
+    const auto* first = geometry();
+    if (!first)
+      return;
+
+    auto& rhi = *renderer.state.rhi;
+    const auto& meshes = node.geometry.meshes->meshes;
+    for (std::size_t i = 1; i < meshes.size(); i++)
+    {
+      const auto& geom = meshes[i];
+      if (!sameLayout(*first, geom))
+        continue;
+
+      Batch batch{.mesh = i};
+      for (const auto& buf : geom.buffers)
+      {
+        const void* data = bufferData(buf.data);
+        if (!data || buf.size <= 0)
+        {
+          batch.buffers.push_back(nullptr);
+          continue;
+        }
+
+        auto b = rhi.newBuffer(
+            QRhiBuffer::Immutable,
+            QRhiBuffer::VertexBuffer | QRhiBuffer::IndexBuffer,
+            quint32(buf.size));
+        b->setName("ModelDisplay::batch");
+        b->create();
+        res.uploadStaticBuffer(b, 0, quint32(buf.size), data);
+        batch.buffers.push_back(b);
+      }
+      m_batches.push_back(std::move(batch));
+    }
+  }
+
+  void releaseBatches()
+  {
+    for (auto& batch : m_batches)
+      for (auto* b : batch.buffers)
+        if (b)
+          b->deleteLater();
+    m_batches.clear();
+  }
+
+  // Whether all the buffers used to draw the geometry were uploaded
+  static bool canDraw(const ossia::geometry& geom, bool indexed, auto&& buffer) noexcept
+  {
+    if (indexed && !buffer(geom.index.buffer))
+      return false;
+    for (const auto& in : geom.input)
+      if (!buffer(in.buffer))
+        return false;
+    return true;
+  }
+
+  // Draws the geometry with the current pipeline, buffer(i) giving its buffer i
+  static void drawGeometry(
+      QRhiCommandBuffer& cb,
+      const ossia::geometry& geom,
+      bool indexed,
+      auto&& buffer)
+  {
+    QVarLengthArray<QRhiCommandBuffer::VertexInput, 4> inputs;
+    for (const auto& in : geom.input)
+      inputs.push_back({buffer(in.buffer), quint32(in.byte_offset)});
+
+    const int64_t instances = instanceCount(geom);
+    const quint32 count = instances > 0 ? quint32(instances) : 1;
+    if (indexed)
+    {
+      const auto& idx = geom.index;
+      const auto format = idx.format == decltype(geom.index)::uint32
+                              ? QRhiCommandBuffer::IndexUInt32
+                              : QRhiCommandBuffer::IndexUInt16;
+      cb.setVertexInput(
+          0,
+          inputs.size(),
+          inputs.data(),
+          buffer(idx.buffer),
+          quint32(idx.byte_offset),
+          format);
+      cb.drawIndexed(geom.indices, count);
+    }
+    else
+    {
+      cb.setVertexInput(0, inputs.size(), inputs.data());
+      cb.draw(geom.vertices, count);
+    }
+  }
+
+  static bool isIndexed(const ossia::geometry& geom) noexcept
+  {
+    return geom.indices > 0 && geom.index.buffer >= 0;
+  }
+
   void runRenderPass(RenderList& renderer, QRhiCommandBuffer& cb, Edge& edge) override
   {
     const auto& mesh = m_mesh ? *m_mesh : renderer.defaultQuad();
-    defaultRenderPass(renderer, mesh, cb, edge);
+    const auto* geom = geometry();
+    auto meshBuffer = [this](int i) -> QRhiBuffer*
+    {
+      return i >= 0 && i < std::ssize(m_meshbufs.buffers) ? m_meshbufs.buffers[i].handle
+                                                          : nullptr;
+    };
+
+    // Single instance of a non-indexed mesh
+    if (!geom
+        || (!isIndexed(*geom) && instanceCount(*geom) == 0 && m_batches.empty())
+        || !canDraw(*geom, isIndexed(*geom), meshBuffer))
+    {
+      defaultRenderPass(renderer, mesh, cb, edge);
+      return;
+    }
+
+    auto it = std::find_if(
+        m_p.begin(), m_p.end(), [&edge](const auto& p) { return p.first == &edge; });
+    // The shaders may not be ready yet
+    if (it == m_p.end())
+      return;
+    const auto& pass = it->second;
+
+    const auto rt = renderer.renderTargetForOutput(edge);
+    if (!rt.renderTarget)
+      return;
+    const auto sz = rt.renderTarget->pixelSize();
+
+    cb.setGraphicsPipeline(pass.pipeline);
+    cb.setShaderResources(pass.srb);
+    cb.setViewport(QRhiViewport(0, 0, sz.width(), sz.height()));
+
+    drawGeometry(cb, *geom, isIndexed(*geom), meshBuffer);
+
+    const auto& meshes = node.geometry.meshes->meshes;
+    for (const auto& batch : m_batches)
+    {
+      if (batch.mesh >= meshes.size())
+        continue;
+
+      const auto& g = meshes[batch.mesh];
+      auto batchBuffer = [&batch](int i) -> QRhiBuffer*
+      { return i >= 0 && i < std::ssize(batch.buffers) ? batch.buffers[i] : nullptr; };
+      if (canDraw(g, isIndexed(g), batchBuffer))
+        drawGeometry(cb, g, isIndexed(g), batchBuffer);
+    }
   }
 
   void release(RenderList& r) override
   {
     m_inputTarget.release();
+
+    m_p.clear();
+    releasePipelines();
+    releaseBatches();
+    m_shaders.clear();
+
+    // Results of the jobs still running are dropped
+    m_jobs = std::make_shared<Threedim::job_mailbox<Renderer>>();
+    m_pendingShaders.reset();
+    m_passesDirty = false;
     defaultRelease(r);
   }
 };
@@ -0,0 +1,244 @@
+#include "ShaderCache.hpp"
+
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QFile>
+#include <QSaveFile>
+#include <QtGlobal>
+
+#if QT_VERSION >= QT_VERSION_CHECK(6, 6, 0)
+#include <rhi/qshaderbaker.h>
+#else
+#include <QtShaderTools/private/qshaderbaker_p.h>
+#endif
+
+#include <utility>
+
+namespace score::gfx
+{
+// Baked shaders kept on disk, in bytes
+static constexpr int64_t model_display_shader_budget = 64 * 1024 * 1024;
+
+static QByteArray model_display_shader_key(
+    const ModelDisplayShaderTarget& target,
+    const QString& vertex,
+    const QString& fragment)
+{
+  QCryptographicHash hash{QCryptographicHash::Sha256};
+  hash.addData(vertex.toUtf8());
+  hash.addData(QByteArray(1, '\0'));
+  hash.addData(fragment.toUtf8());
+
+  // The baked output also depends on the backend and on the Qt shader tools
+  hash.addData(QByteArray::number(int(target.api)));
+  hash.addData(QByteArray::number(target.version.version()));
+  hash.addData(QByteArray::number(int(target.version.flags())));
+  hash.addData(QByteArrayLiteral(QT_VERSION_STR));
+  return hash.result();
+}
+
+// Each call has its own baker: score's shared one is only for the render thread
+static QShader model_display_bake(
+    const ModelDisplayShaderTarget& target,
+    QShader::Stage stage,
+    const QString& source)
+{
+  QShader::Source language{};
+  switch (target.api)
+  {
+    case GraphicsApi::OpenGL:
+      language = QShader::GlslShader;
+      break;
+    case GraphicsApi::Vulkan:
+      language = QShader::SpirvShader;
+      break;
+    case GraphicsApi::Metal:
+      language = QShader::MslShader;
+      break;
+    default:
+      language = QShader::HlslShader;
+      break;
+  }
+
+  QShaderBaker baker;
+  baker.setGeneratedShaders({{language, target.version}});
+  baker.setGeneratedShaderVariants({QShader::StandardShader});
+  baker.setSourceString(source.toUtf8(), stage);
+
+  QShader shader = baker.bake();
+  if (!shader.isValid())
+    qDebug() << "ModelDisplay: " << baker.errorMessage();
+  return shader;
+}
+
+ModelDisplayShaderTarget ModelDisplayShaderTarget::of(const RenderState& state)
+{
+  return {state.api, state.version};
+}
+
+ModelDisplayShaderCache& ModelDisplayShaderCache::instance()
+{
+  static ModelDisplayShaderCache cache;
+  return cache;
+}
+
+// The magic is bumped whenever the file layout changes
+ModelDisplayShaderCache::ModelDisplayShaderCache()
+    : m_files{"model-display", ".qsb", "MDS1", model_display_shader_budget}
+{
+}
+
+std::pair<QShader, QShader> ModelDisplayShaderCache::shaders(
+    const ModelDisplayShaderTarget& target,
+    const QString& vertex,
+    const QString& fragment)
+{
+  const QByteArray key = model_display_shader_key(target, vertex, fragment);
+  {
+    std::lock_guard lock{m_mutex};
+    if (auto it = m_shaders.find(key); it != m_shaders.end())
+      return it->second;
+  }
+
+  // Disk accesses and compilation happen outside of the lock
+  std::pair<QShader, QShader> res;
+  if (!m_files.read(key, [&res](QIODevice& f) { return read(f, res); }))
+  {
+    res = {
+        model_display_bake(target, QShader::VertexStage, vertex),
+        model_display_bake(target, QShader::FragmentStage, fragment)};
+    if (res.first.isValid() && res.second.isValid())
+      m_files.write(key, [&res](QIODevice& f) { write(f, res); });
+  }
+
+  std::lock_guard lock{m_mutex};
+  m_shaders.insert_or_assign(key, res);
+  return res;
+}
+
+QString ModelDisplayShaderCache::pipelinesPath(QRhi& rhi) const
+{
+  const QString& dir = m_files.directory();
+  if (dir.isEmpty())
+    return {};
+
+  QString file = dir + "/pipelines-" + QString::fromLatin1(rhi.backendName());
+#if QT_VERSION >= QT_VERSION_CHECK(6, 6, 0)
+  // A file per device: each GPU of a multi-GPU setup keeps its own pipelines
+  QCryptographicHash hash{QCryptographicHash::Sha256};
+  const QRhiDriverInfo driver = rhi.driverInfo();
+  hash.addData(driver.deviceName);
+  hash.addData(QByteArray::number(driver.deviceId));
+  hash.addData(QByteArray::number(driver.vendorId));
+  file += "-" + QString::fromLatin1(hash.result().toHex().left(16));
+#endif
+  return file + ".bin";
+}
+
+void ModelDisplayShaderCache::restorePipelines(QRhi& rhi)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 6, 0)
+  if (!rhi.isFeatureSupported(QRhi::PipelineCache))
+    return;
+  {
+    std::lock_guard lock{m_mutex};
+    if (m_pipelinesDisabled || !m_restored.insert(&rhi).second)
+      return;
+  }
+
+  // Saved once, when the QRhi goes away: its device is still alive at this point.
+  // A QRhi created later at the same address is restored again.
+  rhi.addCleanupCallback(
+      [this](QRhi* destroyed)
+      {
+        savePipelines(*destroyed);
+        std::lock_guard lock{m_mutex};
+        m_restored.erase(destroyed);
+      });
+
+  // The QRhi checks that the data matches the device and driver
+  QFile f{pipelinesPath(rhi)};
+  if (f.open(QIODevice::ReadOnly))
+    rhi.setPipelineCacheData(f.readAll());
+#endif
+}
+
+void ModelDisplayShaderCache::savePipelines(QRhi& rhi)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 6, 0)
+  const QString file = pipelinesPath(rhi);
+  if (file.isEmpty())
+    return;
+
+  // Model Display created pipelines with this QRhi, so the data is normally
+  // only empty when the QRhi was created without
+  // QRhi::EnablePipelineCacheDataSave. The QRhi does not tell its flags.
+  const QByteArray data = rhi.pipelineCacheData();
+  if (data.isEmpty())
+  {
+    std::lock_guard lock{m_mutex};
+    if (!m_pipelinesDisabled)
+    {
+      qDebug() << "ModelDisplay: the QRhi does not save its pipeline cache "
+                  "(QRhi::EnablePipelineCacheDataSave is not set), pipelines "
+                  "are compiled again at each start";
+      m_pipelinesDisabled = true;
+    }
+    return;
+  }
+
+  QSaveFile f{file};
+  if (f.open(QIODevice::WriteOnly))
+  {
+    f.write(data);
+    f.commit();
+  }
+#endif
+}
+
+bool ModelDisplayShaderCache::find(
+    const ModelDisplayShaderTarget& target,
+    const QString& vertex,
+    const QString& fragment,
+    std::pair<QShader, QShader>& out)
+{
+  const QByteArray key = model_display_shader_key(target, vertex, fragment);
+  std::lock_guard lock{m_mutex};
+  if (auto it = m_shaders.find(key); it != m_shaders.end())
+  {
+    out = it->second;
+    return true;
+  }
+  return false;
+}
+
+// Layout: for each stage its size followed by QShader::serialized()
+bool ModelDisplayShaderCache::read(QIODevice& f, std::pair<QShader, QShader>& out)
+{
+  auto stage = [&f](QShader& shader)
+  {
+    uint64_t bytes{};
+    if (f.read(reinterpret_cast<char*>(&bytes), sizeof(bytes)) != sizeof(bytes))
+      return false;
+    if (bytes > uint64_t(f.size() - f.pos()))
+      return false;
+
+    shader = QShader::fromSerialized(f.read(bytes));
+    return shader.isValid();
+  };
+  return stage(out.first) && stage(out.second);
+}
+
+void ModelDisplayShaderCache::write(
+    QIODevice& f,
+    const std::pair<QShader, QShader>& shaders)
+{
+  for (const QShader* shader : {&shaders.first, &shaders.second})
+  {
+    const QByteArray data = shader->serialized();
+    const uint64_t bytes = data.size();
+    f.write(reinterpret_cast<const char*>(&bytes), sizeof(bytes));
+    f.write(data);
+  }
+}
+}
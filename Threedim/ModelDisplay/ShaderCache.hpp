@@ -0,0 +1,82 @@
+#pragma once
+
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <Gfx/Graph/RenderState.hpp>
+#include <Threedim/BlobCache.hpp>
+
+#include <QByteArray>
+#include <QString>
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <utility>
+
+namespace score::gfx
+{
+//! What the shaders are baked for
+struct ModelDisplayShaderTarget
+{
+  GraphicsApi api{};
+  QShaderVersion version;
+
+  static ModelDisplayShaderTarget of(const RenderState& state);
+};
+
+/**
+ * @brief Cache of the shaders baked for Model Display.
+ *
+ * Entries are keyed by a digest of the final sources and of the graphics API
+ * and shader version they are baked for. Baked shaders are shared by all the
+ * nodes in memory and serialized to a BlobCache, so that loading a show only
+ * compiles the programs which were never seen before.
+ *
+ * The pipeline cache of the QRhi, when it has one, is also kept there, in a
+ * file per backend and device, so that the drivers do not have to compile the
+ * pipelines themselves again. The QRhi only hands it over when it was created
+ * with QRhi::EnablePipelineCacheDataSave, which is up to score: without it,
+ * this is logged once and the pipelines are neither saved nor restored.
+ *
+ * Shaders are baked with a QShaderBaker of each call, never through score's
+ * makeShaders, whose state is shared with the render thread: shaders() can be
+ * called from any thread. The pipeline functions are for the render thread.
+ */
+class ModelDisplayShaderCache
+{
+public:
+  static ModelDisplayShaderCache& instance();
+
+  //! Bakes the shaders for target, unless they are cached
+  std::pair<QShader, QShader> shaders(
+      const ModelDisplayShaderTarget& target,
+      const QString& vertex,
+      const QString& fragment);
+
+  //! Only looks in memory: never compiles nor reads files
+  bool find(
+      const ModelDisplayShaderTarget& target,
+      const QString& vertex,
+      const QString& fragment,
+      std::pair<QShader, QShader>& out);
+
+  //! Loads the saved pipeline cache, once per QRhi, before its first pipelines.
+  //! It is saved back when that QRhi is destroyed.
+  void restorePipelines(QRhi& rhi);
+
+private:
+  ModelDisplayShaderCache();
+
+  void savePipelines(QRhi& rhi);
+  QString pipelinesPath(QRhi& rhi) const;
+  static bool read(QIODevice& f, std::pair<QShader, QShader>& out);
+  static void write(QIODevice& f, const std::pair<QShader, QShader>& shaders);
+
+  std::mutex m_mutex;
+  std::map<QByteArray, std::pair<QShader, QShader>> m_shaders;
+  std::set<QRhi*> m_restored;
+  //! Set once a QRhi did not hand its pipeline cache over
+  bool m_pipelinesDisabled{};
+  Threedim::BlobCache m_files;
+};
+}
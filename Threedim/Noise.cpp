@@ -1,137 +1,190 @@
 #include "Noise.hpp"
 
-#include <PerlinNoise.hpp>
+#include <Threedim/BufferPool.hpp>
+#include <Threedim/NoiseKernel.hpp>
+#include <Threedim/ThreadPool.hpp>
 
 #include <QDebug>
 
-#include <cassert>
+#include <algorithm>
+#include <cmath>
+#include <utility>
 namespace Threedim
 {
-Noise::Noise() { }
+static halp::dynamic_geometry::attribute
+noise_attribute(const halp::dynamic_geometry& mesh, int location)
+{
+  auto it = std::find_if(
+      mesh.attributes.begin(),
+      mesh.attributes.end(),
+      [location](auto& a) { return a.location == location; });
+  return *it;
+}
 
-Noise::~Noise()
+// Points the binding of attr to a copy of its data in storage.
+// The whole binding is copied so that attributes interleaved with the one
+// being modified keep their relative layout.
+static void noise_detach_binding(
+    halp::dynamic_geometry& mesh,
+    const halp::dynamic_geometry::attribute& attr,
+    PooledBuffer& storage)
 {
-  if (!outputs.geometry.mesh.buffers.empty())
+  auto& ins = mesh.input;
+  auto& bufs = mesh.buffers;
+
+  const int binding = attr.binding;
+  const int64_t stride = attribute_stride(mesh, attr);
+
+  const auto& src = bufs[ins[binding].buffer];
+  const int64_t src_offset = ins[binding].offset;
+  const int64_t bytes = std::min(mesh.vertices * stride, src.size - src_offset);
+
+  GeometryBufferPool::instance().resize(storage, bytes);
+  std::memcpy(storage.data(), (const char*)src.data + src_offset, bytes);
+
+  bufs.push_back({.data = storage.data(), .size = bytes, .dirty = true});
+  ins[binding] = {.buffer = int(bufs.size() - 1), .offset = 0};
+}
+
+bool Noise::input_changed()
+{
+  auto& in = inputs.geometry;
+  bool changed = in.dirty_mesh || in.mesh.vertices != m_inputVertices
+                 || in.mesh.buffers.size() != m_inputBuffers.size();
+  for (std::size_t i = 0; !changed && i < in.mesh.buffers.size(); i++)
   {
-    auto& b = outputs.geometry.mesh.buffers[0];
-    delete[] (float*)b.data;
+    const auto& buf = in.mesh.buffers[i];
+    changed = buf.dirty || buf.data != m_inputBuffers[i].first
+              || buf.size != m_inputBuffers[i].second;
   }
+
+  if (changed)
+  {
+    m_inputVertices = in.mesh.vertices;
+    m_inputBuffers.clear();
+    for (auto& buf : in.mesh.buffers)
+      m_inputBuffers.emplace_back(buf.data, buf.size);
+  }
+  return changed;
 }
 
-const siv::BasicPerlinNoise<double> engine{4u}; // chosen by fair dice roll
 void Noise::operator()(tick tt)
 {
-  auto old_bufs = outputs.geometry.mesh.buffers;
-  (GeometryPort&)outputs.geometry = (const GeometryPort&)inputs.geometry;
-
-  if (!outputs.geometry.mesh.buffers.empty())
+  NoiseParameters params{
+      .mode = {inputs.dx, inputs.dy, inputs.dz},
+      .intensity
+      = {inputs.ix.value * 100.f, inputs.iy.value * 100.f, inputs.iz.value * 100.f},
+      .time = float(tt.position_in_frames / 44100.),
+      .octaves = inputs.octaves,
+      .lacunarity = inputs.lacunarity,
+      .gain = inputs.gain};
+  if (std::all_of(
+          std::begin(params.mode),
+          std::end(params.mode),
+          [](auto m) { return m == DeformationControl::None; }))
+    params.time = 0.f;
+
+  const bool geometry_changed = input_changed() || !m_computed;
+  if (inputs.geometry.dirty_transform)
   {
-    int old_buf_idx = 0;
-    for (auto& buf : outputs.geometry.mesh.buffers)
-    {
-      if (old_buf_idx < old_bufs.size())
-      {
-        auto old = old_bufs[old_buf_idx];
-        auto cur = (float*)buf.data;
-        void* newb{};
-        if (buf.size == old.size)
-        {
-          newb = old.data;
-        }
-        else
-        {
-          delete[] (float*)old.data;
-          newb = new float[buf.size];
-        }
-        memcpy(newb, cur, buf.size);
-        buf.data = newb;
-      }
-      else
-      {
-        auto cur = (float*)buf.data;
-        buf.data = new float[buf.size];
-        memcpy(buf.data, cur, buf.size);
-      }
-      old_buf_idx++;
-    }
+    std::copy_n(inputs.geometry.transform, 16, outputs.geometry.transform);
+    outputs.geometry.dirty_transform = true;
+    inputs.geometry.dirty_transform = false;
   }
-  else
+
+  // Nothing to do when paused or when nothing changed
+  if (!geometry_changed && m_normalsApplied == bool(inputs.normals))
   {
-    for (auto buf : old_bufs)
-    {
-      delete (float*)buf.data;
-    }
+    if (params == m_params)
+      return;
+
+    // Time alone moves at the tick rate: only follow it at the requested rate
+    NoiseParameters p = m_params;
+    p.time = params.time;
+    const float period = 1.f / std::max(inputs.rate.value, 1.f);
+    if (p == params && std::abs(params.time - m_params.time) < period)
+      return;
   }
+
+  m_computed = true;
+  m_params = params;
+  m_normalsApplied = inputs.normals;
+
+  // Buffers which are not deformed are forwarded as-is:
+  // only the region holding the positions gets copied.
+  (GeometryPort&)outputs.geometry = (const GeometryPort&)inputs.geometry;
   outputs.geometry.dirty_mesh = true;
   outputs.geometry.dirty_transform = true;
 
-  outputs.geometry.dirty_mesh = true;
-  //outputs.geometry.dirty = true;
+  // The changes upstream are now forwarded: buffers which did not change
+  // since then will not be uploaded again on the next evaluations
+  inputs.geometry.dirty_mesh = false;
+  for (auto& buf : inputs.geometry.mesh.buffers)
+    buf.dirty = false;
+
   auto& mesh = outputs.geometry.mesh;
   if (mesh.buffers.empty())
     return;
 
   // Find the position attribute:
-  auto& attr = mesh.attributes;
-  auto it
-      = std::find_if(attr.begin(), attr.end(), [](auto& a) { return a.location == 0; });
-  if (it == attr.end())
+  using attribute = halp::dynamic_geometry::attribute;
+  if (!find_attribute<const float[3]>(std::as_const(mesh), attribute::position))
     return;
 
-  const int binding = it->binding;
-  auto& ins = mesh.input;
-  assert(binding >= 0);
-  assert(binding < ins.size());
+  noise_detach_binding(mesh, noise_attribute(mesh, attribute::position), m_positions);
 
-  const int buffer = ins[binding].buffer;
+  auto vertices = *find_attribute<float[3]>(mesh, attribute::position);
 
-  auto& bufs = mesh.buffers;
-  assert(buffer >= 0);
-  assert(buffer < bufs.size());
+  // Chunks of 16k vertices (192 kB of positions) stay within L2.
+  // Small meshes are not worth waking up the pool for.
+  static constexpr int64_t chunk_size = 16384;
+  if (vertices.size() < 4 * chunk_size)
+  {
+    deform_vertices(vertices, params);
+  }
+  else
+  {
+    ThreadPool::instance().parallel_for(
+        vertices.size(),
+        chunk_size,
+        [&](int64_t b, int64_t e) { deform_vertices(vertices.subspan(b, e - b), params); });
+  }
 
-  auto& buf = bufs[buffer];
+  if (inputs.normals && mesh.topology == halp::dynamic_geometry::triangles)
+    update_normals();
+}
 
-  // Cheat a bit for now... and assume that position comes first,
-  // and that things aren't interleaved,
-  // and that we have float[3]s, ...
-  using type = float[3];
-  std::span<type> vertices((type*)buf.data, mesh.vertices);
+void Noise::update_normals()
+{
+  auto& mesh = outputs.geometry.mesh;
+  using attribute = halp::dynamic_geometry::attribute;
+  if (!find_attribute<const float[3]>(std::as_const(mesh), attribute::normal))
+    return;
 
-  using f_type = double (*)(double x, double intens, double t) noexcept;
-  auto func = [&](DeformationControl::enum_type c) noexcept -> f_type
+  const auto normal = noise_attribute(mesh, attribute::normal);
+  if (normal.binding != noise_attribute(mesh, attribute::position).binding)
+    noise_detach_binding(mesh, normal, m_normalStorage);
+
+  auto positions = *find_attribute<const float[3]>(std::as_const(mesh), attribute::position);
+  auto normals = *find_attribute<float[3]>(mesh, attribute::normal);
+
+  const auto& idx = mesh.index;
+  if (idx.buffer >= 0 && idx.buffer < std::ssize(mesh.buffers))
   {
-    switch (c)
-    {
-      default:
-      case DeformationControl::None:
-        return [](double x, double intens, double t) noexcept { return x; };
-        break;
-      case DeformationControl::Noise:
-        return [](double x, double intens, double t) noexcept
-        { return x + intens * 100. * engine.noise1D(x + t); };
-        break;
-      case DeformationControl::Sine:
-        return [](double x, double intens, double t) noexcept
-        { return x + intens * 100. * std::sin(x + t); };
-        break;
-    }
-  };
-
-  const f_type fs[3] = {func(inputs.dx), func(inputs.dy), func(inputs.dz)};
-
-  const double t = tt.position_in_frames / 44100.;
-
-  const double ix = inputs.ix.value;
-  const double iy = inputs.iy.value;
-  const double iz = inputs.iz.value;
-
-  for (float(&v)[3] : vertices)
+    const auto& buf = mesh.buffers[idx.buffer];
+    const bool uint32 = idx.format == decltype(mesh.index)::uint32;
+    // The buffer may hold more than the indices of this mesh, but never less
+    const int64_t stored = (buf.size - idx.offset) / (uint32 ? 4 : 2);
+    const int64_t count = std::min(int64_t(mesh.indices), stored);
+    m_normals.compute(
+        positions,
+        {(const char*)buf.data + idx.offset, count, uint32, buf.dirty},
+        normals);
+  }
+  else
   {
-    v[0] = fs[0](v[0], ix, t + v[1] + v[2]);
-    v[1] = fs[1](v[1], iy, t + v[0] + v[2]);
-    v[2] = fs[2](v[2], iz, t + v[0] + v[1]);
+    m_normals.compute(positions, normals);
   }
-  mesh.buffers[0].dirty = true;
 }
 
 }
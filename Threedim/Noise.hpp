@@ -2,6 +2,8 @@
 
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 
+#include <Threedim/BufferPool.hpp>
+#include <Threedim/Normals.hpp>
 #include <halp/controls.hpp>
 #include <halp/geometry.hpp>
 #include <halp/meta.hpp>
@@ -10,6 +12,8 @@
 #include <cstring>
 #include <random>
 #include <span>
+#include <utility>
+#include <vector>
 
 namespace Threedim
 {
@@ -26,7 +30,10 @@ struct DeformationControl
   {
     None,
     Noise,
-    Sine
+    Sine,
+    FBm,
+    Ridged,
+    Curl
   } value{};
 
   enum widget
@@ -38,7 +45,7 @@ struct DeformationControl
 
   struct range
   {
-    std::string_view values[3]{"None", "Noise", "Sine"};
+    std::string_view values[6]{"None", "Noise", "Sine", "fBm", "Ridged", "Curl"};
     enum_type init = enum_type::Noise;
   };
 
@@ -51,6 +58,20 @@ struct DeformationControl
   }
 };
 
+struct NoiseParameters
+{
+  DeformationControl::enum_type mode[3]{};
+  float intensity[3]{};
+  float time{};
+
+  // For the fBm, ridged and curl modes
+  int octaves{1};
+  float lacunarity{2.f};
+  float gain{0.5f};
+
+  bool operator==(const NoiseParameters&) const noexcept = default;
+};
+
 struct Noise
 {
   halp_meta(name, "Mesh Noise")
@@ -81,6 +102,11 @@ struct Noise
     halp::hslider_f32<"Intensity X"> ix;
     halp::hslider_f32<"Intensity Y"> iy;
     halp::hslider_f32<"Intensity Z"> iz;
+    halp::hslider_i32<"Octaves", halp::range{1, 8, 4}> octaves;
+    halp::hslider_f32<"Lacunarity", halp::range{1, 4, 2}> lacunarity;
+    halp::hslider_f32<"Gain", halp::range{0, 1, 0.5}> gain;
+    halp::toggle<"Recompute normals"> normals;
+    halp::hslider_f32<"Max. update rate", halp::range{1, 240, 60}> rate;
 
   } inputs;
 
@@ -92,9 +118,6 @@ struct Noise
     } geometry;
   } outputs;
 
-  Noise();
-  ~Noise();
-
   struct tick
   {
     int frames;
@@ -102,5 +125,18 @@ struct Noise
   };
 
   void operator()(tick);
+  bool input_changed();
+  void update_normals();
+
+  PooledBuffer m_positions;
+  PooledBuffer m_normalStorage;
+  VertexNormals m_normals;
+
+  // What the current output was computed from
+  std::vector<std::pair<const void*, int64_t>> m_inputBuffers;
+  int64_t m_inputVertices{-1};
+  NoiseParameters m_params;
+  bool m_normalsApplied{};
+  bool m_computed{};
 };
 }
@@ -0,0 +1,120 @@
+#include "NoiseKernel.hpp"
+
+#include <Threedim/NoiseKernelImpl.hpp>
+
+#include <numeric>
+#include <random>
+#include <utility>
+
+namespace Threedim
+{
+noise_gradient_table::noise_gradient_table(uint32_t seed)
+{
+  // Same shuffle as siv::PerlinNoise::reseed: unlike std::shuffle, it gives
+  // the same permutation with every standard library
+  uint8_t perm[256];
+  std::iota(std::begin(perm), std::end(perm), 0);
+  std::mt19937 rng{seed};
+  for (uint64_t i = 1; i < 256; i++)
+    std::swap(perm[i], perm[rng() % (i + 1)]);
+
+  auto grad = [](uint8_t hash, double x, double y, double z)
+  {
+    const int h = hash & 15;
+    const double u = h < 8 ? x : y;
+    const double v = h < 4 ? y : h == 12 || h == 14 ? x : z;
+    return ((h & 1) == 0 ? u : -u) + ((h & 2) == 0 ? v : -v);
+  };
+  auto fade = [](double t) { return t * t * t * (t * (t * 6 - 15) + 10); };
+  auto lerp = [](double a, double b, double t) { return a + (b - a) * t; };
+
+  constexpr double y = 0.12345, z = 0.34567;
+  const double v = fade(y), w = fade(z);
+  for (int i = 0; i < 256; i++)
+  {
+    const int a = perm[i];
+    const int aa = perm[a], ab = perm[(a + 1) & 255];
+    auto corner = [&](double x)
+    {
+      return lerp(
+          lerp(grad(perm[aa], x, y, z), grad(perm[ab], x, y - 1, z), v),
+          lerp(
+              grad(perm[(aa + 1) & 255], x, y, z - 1),
+              grad(perm[(ab + 1) & 255], x, y - 1, z - 1),
+              v),
+          w);
+    };
+    offset[i] = corner(0.);
+    slope[i] = corner(1.) - corner(0.);
+  }
+  slope[256] = slope[0];
+  offset[256] = offset[0];
+}
+
+// The seed of the siv::PerlinNoise used before: the Noise mode deforms the same way
+const noise_gradient_table noise_gradients{4u}; // chosen by fair dice roll
+
+noise_lattice_table::noise_lattice_table(uint32_t seed)
+{
+  // Only the output of mt19937 itself is specified by the standard: the shuffle and
+  // the directions are written out so that every standard library builds this lattice
+  std::mt19937 rng{seed};
+  uint8_t p[256];
+  std::iota(std::begin(p), std::end(p), 0);
+  for (uint64_t i = 255; i > 0; i--)
+    std::swap(p[i], p[rng() % (i + 1)]);
+
+  // Uniformly distributed unit vectors: points drawn in the unit ball, by rejection
+  // from the cube. Unlike a normal distribution, this needs no log nor cos, whose
+  // last bits differ between math libraries. The squares of these floats are exact
+  // in double, so the result does not depend on FMA contraction either.
+  auto uniform = [&rng] { return double(rng() >> 8) * (2. / 16777216.) - 1.; };
+  float dirs[256][3];
+  for (auto& d : dirs)
+  {
+    double v[3]{};
+    double len = 0.;
+    while (len < 1e-3 || len > 1.)
+    {
+      for (double& c : v)
+        c = uniform();
+      len = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    }
+    for (int c = 0; c < 3; c++)
+      d[c] = float(v[c] / len);
+  }
+
+  for (int i = 0; i < 512; i++)
+  {
+    perm[i] = p[i & 255];
+    const auto& d = dirs[p[(i + 97) & 255]];
+    grad[i][0] = d[0];
+    grad[i][1] = d[1];
+    grad[i][2] = d[2];
+    grad[i][3] = 0.f;
+  }
+}
+
+const noise_lattice_table noise_lattice{7u};
+
+#if defined(THREEDIM_NOISE_AVX2) && !defined(__AVX2__)
+bool simd_has_avx2() noexcept
+{
+  static const bool res = []
+  {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  }();
+  return res;
+}
+#endif
+
+void deform_vertices(attribute_span<float[3]> vertices, const NoiseParameters& p) noexcept
+{
+#if defined(THREEDIM_NOISE_AVX2) && !defined(__AVX2__)
+  if (simd_has_avx2())
+    return deform_vertices_avx2(vertices, p);
+#endif
+  deform_vertices_impl(vertices, p);
+}
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <Threedim/AttributeView.hpp>
+#include <Threedim/Noise.hpp>
+
+#include <cstdint>
+
+namespace Threedim
+{
+// Deforms float[3] positions in place.
+// The layout (packed or interleaved) and whether 3D noise is needed are resolved
+// once for the whole span, and the vertices are processed 8 at a time with the widest
+// SIMD instruction set available at build time (AVX2, NEON, or plain loops
+// that the compiler can vectorize). On x86-64, an AVX2 build of the kernel is
+// also picked at runtime when the CPU supports it.
+void deform_vertices(attribute_span<float[3]> vertices, const NoiseParameters& p) noexcept;
+}
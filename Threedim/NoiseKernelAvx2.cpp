@@ -0,0 +1,41 @@
+#include <Threedim/NoiseKernelImpl.hpp>
+#include <Threedim/NormalsKernelImpl.hpp>
+
+// CMakeLists.txt builds this file with -mavx2 -mfma: the kernels are only called
+// from NoiseKernel.cpp and Normals.cpp when the CPU supports them
+namespace Threedim
+{
+void deform_vertices_avx2(attribute_span<float[3]> vertices, const NoiseParameters& p) noexcept
+{
+  deform_vertices_impl(vertices, p);
+}
+
+void normals_soup_avx2(
+    attribute_span<const float[3]> positions,
+    attribute_span<float[3]> normals,
+    int64_t begin,
+    int64_t end) noexcept
+{
+  normals_soup_impl(positions, normals, begin, end);
+}
+
+void normals_faces_avx2(
+    const uint16_t* idx,
+    attribute_span<const float[3]> positions,
+    float* const (&n)[3],
+    int64_t begin,
+    int64_t end) noexcept
+{
+  normals_faces_impl(idx, positions, n, begin, end);
+}
+
+void normals_faces_avx2(
+    const uint32_t* idx,
+    attribute_span<const float[3]> positions,
+    float* const (&n)[3],
+    int64_t begin,
+    int64_t end) noexcept
+{
+  normals_faces_impl(idx, positions, n, begin, end);
+}
+}
@@ -0,0 +1,423 @@
+#pragma once
+
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+// The deformation kernel, included by each translation unit which builds it for
+// an instruction set. Apart from the tables, everything here has internal linkage.
+
+#include <Threedim/NoiseKernel.hpp>
+#include <Threedim/Simd.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace Threedim
+{
+// The lookup tables are only built in NoiseKernel.cpp: the other builds of the
+// kernel read them and do not instantiate anything from <random>.
+
+// The noise1D of siv::PerlinNoise: its 3D noise along x, at y = 0.12345 and
+// z = 0.34567. On that line, the four lattice corners above each x lattice point
+// blend into a single linear term slope * (x - i) + offset.
+// The 257th entry wraps around so that the (i, i+1) lookups never need a second modulo.
+struct noise_gradient_table
+{
+  alignas(64) float slope[257];
+  alignas(64) float offset[257];
+
+  explicit noise_gradient_table(uint32_t seed);
+};
+extern const noise_gradient_table noise_gradients;
+
+// Lattice for the 3D noise. Indices are stored as floats so that every lookup
+// is a plain float gather.
+// perm is doubled so that perm[perm[X] + Y + 1] needs no modulo, and the gradient
+// of each final hash is stored directly (x y z 0) instead of going through
+// a last permutation lookup: one 16-byte entry per lattice corner.
+struct noise_lattice_table
+{
+  alignas(64) float perm[512];
+  alignas(64) float grad[512][4];
+
+  explicit noise_lattice_table(uint32_t seed);
+};
+extern const noise_lattice_table noise_lattice;
+
+namespace
+{
+constexpr float two_pi = 6.28318530717958647692f;
+
+inline simd_f32 perlin(simd_f32 x) noexcept
+{
+  const simd_f32 one = simd_f32::broadcast(1.f);
+  const simd_f32 period = simd_f32::broadcast(256.f);
+
+  // Wrap into [0; 256) first so that the lattice index can't overflow
+  x = x - period * floor(x * simd_f32::broadcast(1.f / 256.f));
+  const simd_f32 i = min(floor(x), simd_f32::broadcast(255.f));
+  const simd_f32 f = x - i;
+
+  const auto& g = noise_gradients;
+  const simd_f32 g0 = gather(g.slope, i) * f + gather(g.offset, i);
+  const simd_f32 g1 = gather(g.slope, i + one) * (f - one) + gather(g.offset, i + one);
+
+  // 6t^5 - 15t^4 + 10t^3
+  const simd_f32 u
+      = f * f * f
+        * (f * (f * simd_f32::broadcast(6.f) - simd_f32::broadcast(15.f))
+           + simd_f32::broadcast(10.f));
+  return g0 + u * (g1 - g0);
+}
+
+inline simd_f32 sine(simd_f32 x) noexcept
+{
+  // Reduce to t in [-1; 1] with x = pi * t (mod 2 pi)
+  simd_f32 t = x * simd_f32::broadcast(1.f / two_pi);
+  t = t - floor(t + simd_f32::broadcast(0.5f));
+  t = t * simd_f32::broadcast(2.f);
+
+  // sin(pi * t) = sin(pi * (1 - t)): fold into [-0.5; 0.5]
+  t = max(min(t, simd_f32::broadcast(1.f) - t), simd_f32::broadcast(-1.f) - t);
+
+  // Taylor series up to x^9, error < 4e-6 on [-pi/2; pi/2]
+  const simd_f32 a = t * simd_f32::broadcast(two_pi / 2.f);
+  const simd_f32 a2 = a * a;
+  simd_f32 p = simd_f32::broadcast(1.f / 362880.f);
+  p = p * a2 - simd_f32::broadcast(1.f / 5040.f);
+  p = p * a2 + simd_f32::broadcast(1.f / 120.f);
+  p = p * a2 - simd_f32::broadcast(1.f / 6.f);
+  p = p * a2 + simd_f32::broadcast(1.f);
+  return p * a;
+}
+
+struct vec3
+{
+  simd_f32 x, y, z;
+};
+
+struct noise_sample
+{
+  simd_f32 value;
+  vec3 d; // Gradient, only computed for curl noise
+};
+
+// Wraps into [0; 256) and splits into lattice cell and fractional part
+inline void lattice_cell(simd_f32 x, simd_f32& cell, simd_f32& frac) noexcept
+{
+  x = x - simd_f32::broadcast(256.f) * floor(x * simd_f32::broadcast(1.f / 256.f));
+  cell = min(floor(x), simd_f32::broadcast(255.f));
+  frac = x - cell;
+}
+
+// 3D gradient noise, output within [-1; 1]
+template <bool Derivatives>
+inline noise_sample gradient_noise_3d(simd_f32 x, simd_f32 y, simd_f32 z) noexcept
+{
+  const simd_f32 one = simd_f32::broadcast(1.f);
+  const simd_f32 four = simd_f32::broadcast(4.f);
+
+  simd_f32 X, Y, Z, fx, fy, fz;
+  lattice_cell(x, X, fx);
+  lattice_cell(y, Y, fy);
+  lattice_cell(z, Z, fz);
+
+  const simd_f32 a = gather(noise_lattice.perm, X) + Y;
+  const simd_f32 b = gather(noise_lattice.perm, X + one) + Y;
+  const simd_f32 aa = (gather(noise_lattice.perm, a) + Z) * four;
+  const simd_f32 ab = (gather(noise_lattice.perm, a + one) + Z) * four;
+  const simd_f32 ba = (gather(noise_lattice.perm, b) + Z) * four;
+  const simd_f32 bb = (gather(noise_lattice.perm, b + one) + Z) * four;
+
+  const simd_f32 fx1 = fx - one, fy1 = fy - one, fz1 = fz - one;
+  struct corner
+  {
+    vec3 g;
+    simd_f32 v;
+  };
+  auto at = [&](simd_f32 h, simd_f32 dx, simd_f32 dy, simd_f32 dz) noexcept
+  {
+    const float* g = &noise_lattice.grad[0][0];
+    corner c{{gather(g, h), gather(g + 1, h), gather(g + 2, h)}, {}};
+    c.v = c.g.x * dx + c.g.y * dy + c.g.z * dz;
+    return c;
+  };
+  const corner c000 = at(aa, fx, fy, fz);
+  const corner c100 = at(ba, fx1, fy, fz);
+  const corner c010 = at(ab, fx, fy1, fz);
+  const corner c110 = at(bb, fx1, fy1, fz);
+  const corner c001 = at(aa + four, fx, fy, fz1);
+  const corner c101 = at(ba + four, fx1, fy, fz1);
+  const corner c011 = at(ab + four, fx, fy1, fz1);
+  const corner c111 = at(bb + four, fx1, fy1, fz1);
+
+  // 6t^5 - 15t^4 + 10t^3
+  auto fade = [](simd_f32 t) noexcept
+  {
+    return t * t * t
+           * (t * (t * simd_f32::broadcast(6.f) - simd_f32::broadcast(15.f))
+              + simd_f32::broadcast(10.f));
+  };
+  const simd_f32 u = fade(fx), v = fade(fy), w = fade(fz);
+
+  // Trilinear interpolation written as a polynomial in u v w
+  auto coefficients = [](simd_f32 p000,
+                         simd_f32 p100,
+                         simd_f32 p010,
+                         simd_f32 p110,
+                         simd_f32 p001,
+                         simd_f32 p101,
+                         simd_f32 p011,
+                         simd_f32 p111) noexcept
+  {
+    struct
+    {
+      simd_f32 k[8];
+    } r{
+        {p000,
+         p100 - p000,
+         p010 - p000,
+         p001 - p000,
+         p000 - p100 - p010 + p110,
+         p000 - p010 - p001 + p011,
+         p000 - p100 - p001 + p101,
+         p100 + p010 + p001 + p111 - p000 - p110 - p011 - p101}};
+    return r;
+  };
+  auto interpolate = [&](const simd_f32 (&k)[8]) noexcept
+  {
+    return k[0] + k[1] * u + k[2] * v + k[3] * w + k[4] * u * v + k[5] * v * w
+           + k[6] * w * u + k[7] * u * v * w;
+  };
+
+  const auto kv = coefficients(
+      c000.v, c100.v, c010.v, c110.v, c001.v, c101.v, c011.v, c111.v);
+
+  noise_sample s;
+  s.value = interpolate(kv.k);
+
+  if constexpr (Derivatives)
+  {
+    // 30t^2 (t - 1)^2
+    auto dfade = [](simd_f32 t) noexcept
+    {
+      const simd_f32 t1 = t - simd_f32::broadcast(1.f);
+      return simd_f32::broadcast(30.f) * t * t * t1 * t1;
+    };
+    const simd_f32 du = dfade(fx), dv = dfade(fy), dw = dfade(fz);
+    const auto& k = kv.k;
+
+    auto interpolate_gradient = [&](simd_f32 vec3::*c) noexcept
+    {
+      return interpolate(
+          coefficients(
+              c000.g.*c, c100.g.*c, c010.g.*c, c110.g.*c, c001.g.*c, c101.g.*c,
+              c011.g.*c, c111.g.*c)
+              .k);
+    };
+    s.d.x = interpolate_gradient(&vec3::x)
+            + du * (k[1] + k[4] * v + k[6] * w + k[7] * v * w);
+    s.d.y = interpolate_gradient(&vec3::y)
+            + dv * (k[2] + k[5] * w + k[4] * u + k[7] * w * u);
+    s.d.z = interpolate_gradient(&vec3::z)
+            + dw * (k[3] + k[6] * u + k[5] * v + k[7] * u * v);
+  }
+  return s;
+}
+
+// Sum of octaves of gradient noise, normalized by the sum of the amplitudes.
+// Ridged noise folds each octave into sharp crests: (1 - |n|)^2.
+template <bool Ridged, bool Derivatives>
+inline noise_sample fractal_noise(vec3 p, const NoiseParameters& params) noexcept
+{
+  const int octaves = std::clamp(params.octaves, 1, 16);
+  float amplitude = 1.f, frequency = 1.f, norm = 0.f;
+
+  noise_sample sum{simd_f32::broadcast(0.f), {}};
+  if constexpr (Derivatives)
+    sum.d = {sum.value, sum.value, sum.value};
+
+  for (int o = 0; o < octaves; o++)
+  {
+    const simd_f32 f = simd_f32::broadcast(frequency);
+    const simd_f32 a = simd_f32::broadcast(amplitude);
+    noise_sample n = gradient_noise_3d<Derivatives>(p.x * f, p.y * f, p.z * f);
+    if constexpr (Ridged)
+    {
+      const simd_f32 r = simd_f32::broadcast(1.f) - max(n.value, simd_f32::broadcast(0.f) - n.value);
+      n.value = r * r;
+    }
+    sum.value = sum.value + a * n.value;
+    if constexpr (Derivatives)
+    {
+      const simd_f32 af = a * f;
+      sum.d = {sum.d.x + af * n.d.x, sum.d.y + af * n.d.y, sum.d.z + af * n.d.z};
+    }
+
+    norm += amplitude;
+    frequency *= params.lacunarity;
+    amplitude *= params.gain;
+  }
+
+  const simd_f32 inv = simd_f32::broadcast(1.f / norm);
+  sum.value = sum.value * inv;
+  if constexpr (Ridged)
+    sum.value = sum.value * simd_f32::broadcast(2.f) - simd_f32::broadcast(1.f);
+  if constexpr (Derivatives)
+    sum.d = {sum.d.x * inv, sum.d.y * inv, sum.d.z * inv};
+  return sum;
+}
+
+// Decorrelates the noise fields used for the three axes
+constexpr float axis_offset[3][3]{
+    {0.f, 0.f, 0.f},
+    {31.416f, 47.853f, 12.793f},
+    {-19.031f, 23.719f, 71.271f}};
+
+inline vec3 offset_position(const simd_f32 (&pos)[3], simd_f32 t, int axis) noexcept
+{
+  return {
+      pos[0] + simd_f32::broadcast(axis_offset[axis][0]),
+      pos[1] + simd_f32::broadcast(axis_offset[axis][1]),
+      pos[2] + t + simd_f32::broadcast(axis_offset[axis][2])};
+}
+
+// Curl of a fractal vector potential: a divergence-free flow,
+// which swirls the mesh around without compressing it.
+inline vec3 curl_noise(const simd_f32 (&pos)[3], simd_f32 t, const NoiseParameters& p) noexcept
+{
+  const vec3 px = fractal_noise<false, true>(offset_position(pos, t, 0), p).d;
+  const vec3 py = fractal_noise<false, true>(offset_position(pos, t, 1), p).d;
+  const vec3 pz = fractal_noise<false, true>(offset_position(pos, t, 2), p).d;
+  return {pz.y - py.z, px.z - pz.x, py.x - px.y};
+}
+
+// Vertices are deformed by tiles, converted to structure-of-arrays form.
+// 256 vertices keep the positions and the curl within 6 kB.
+constexpr int deform_tile_size = 256;
+
+struct deform_tile
+{
+  alignas(32) float pos[3][deform_tile_size];
+  alignas(32) float curl[3][deform_tile_size];
+};
+
+inline simd_f32 load_position(const deform_tile& d, int c, int k) noexcept
+{
+  return simd_f32::load(d.pos[c] + k);
+}
+
+// Deforms one axis of the first `count` vertices of the tile (a multiple of 8).
+// Each axis sees the already-deformed previous ones.
+template <int Axis, DeformationControl::enum_type Mode>
+void deform_axis(deform_tile& d, int count, const NoiseParameters& p) noexcept
+{
+  const simd_f32 t = simd_f32::broadcast(p.time);
+  const simd_f32 intensity = simd_f32::broadcast(p.intensity[Axis]);
+  for (int k = 0; k < count; k += 8)
+  {
+    const simd_f32 pos[3]{load_position(d, 0, k), load_position(d, 1, k), load_position(d, 2, k)};
+    const simd_f32 x = pos[Axis];
+    simd_f32 delta;
+    if constexpr (Mode == DeformationControl::Noise)
+      delta = perlin(x + (t + pos[Axis == 0 ? 1 : 0] + pos[Axis == 2 ? 1 : 2]));
+    else if constexpr (Mode == DeformationControl::Sine)
+      delta = sine(x + (t + pos[Axis == 0 ? 1 : 0] + pos[Axis == 2 ? 1 : 2]));
+    else if constexpr (Mode == DeformationControl::FBm)
+      delta = fractal_noise<false, false>(offset_position(pos, t, Axis), p).value;
+    else if constexpr (Mode == DeformationControl::Ridged)
+      delta = fractal_noise<true, false>(offset_position(pos, t, Axis), p).value;
+    else
+      delta = simd_f32::load(d.curl[Axis] + k);
+    (x + intensity * delta).store(d.pos[Axis] + k);
+  }
+}
+
+// The flow is evaluated once at the undeformed positions so that
+// its three components stay consistent
+inline void deform_curl(deform_tile& d, int count, const NoiseParameters& p) noexcept
+{
+  const simd_f32 t = simd_f32::broadcast(p.time);
+  for (int k = 0; k < count; k += 8)
+  {
+    const simd_f32 pos[3]{load_position(d, 0, k), load_position(d, 1, k), load_position(d, 2, k)};
+    const vec3 c = curl_noise(pos, t, p);
+    c.x.store(d.curl[0] + k);
+    c.y.store(d.curl[1] + k);
+    c.z.store(d.curl[2] + k);
+  }
+}
+
+using deform_axis_kernel = void (*)(deform_tile&, int, const NoiseParameters&) noexcept;
+
+// The mode is dispatched once per buffer: each loop only contains the code of its mode
+template <int Axis>
+deform_axis_kernel axis_kernel(DeformationControl::enum_type mode) noexcept
+{
+  switch (mode)
+  {
+    case DeformationControl::Noise:
+      return deform_axis<Axis, DeformationControl::Noise>;
+    case DeformationControl::Sine:
+      return deform_axis<Axis, DeformationControl::Sine>;
+    case DeformationControl::FBm:
+      return deform_axis<Axis, DeformationControl::FBm>;
+    case DeformationControl::Ridged:
+      return deform_axis<Axis, DeformationControl::Ridged>;
+    case DeformationControl::Curl:
+      return deform_axis<Axis, DeformationControl::Curl>;
+    default:
+      return nullptr;
+  }
+}
+
+template <typename Span>
+void deform_span(Span vertices, const NoiseParameters& p) noexcept
+{
+  const deform_axis_kernel kernels[3]{
+      axis_kernel<0>(p.mode[0]), axis_kernel<1>(p.mode[1]), axis_kernel<2>(p.mode[2])};
+  const bool with_curl = std::find(std::begin(p.mode), std::end(p.mode), DeformationControl::Curl)
+                         != std::end(p.mode);
+
+  deform_tile d;
+  const int64_t n = vertices.size();
+  for (int64_t begin = 0; begin < n; begin += deform_tile_size)
+  {
+    const int count = int(std::min(int64_t(deform_tile_size), n - begin));
+    const int padded = (count + 7) / 8 * 8;
+    for (int k = 0; k < count; k++)
+      for (int c = 0; c < 3; c++)
+        d.pos[c][k] = vertices[begin + k][c];
+    for (int k = count; k < padded; k++)
+      for (int c = 0; c < 3; c++)
+        d.pos[c][k] = 0.f;
+
+    if (with_curl)
+      deform_curl(d, padded, p);
+    for (auto kernel : kernels)
+      if (kernel)
+        kernel(d, padded, p);
+
+    for (int k = 0; k < count; k++)
+      for (int c = 0; c < 3; c++)
+        vertices[begin + k][c] = d.pos[c][k];
+  }
+}
+
+inline void
+deform_vertices_impl(attribute_span<float[3]> vertices, const NoiseParameters& p) noexcept
+{
+  if (p.mode[0] == DeformationControl::None && p.mode[1] == DeformationControl::None
+      && p.mode[2] == DeformationControl::None)
+    return;
+
+  if (vertices.packed())
+    deform_span(vertices.as_packed(), p);
+  else
+    deform_span(vertices, p);
+}
+}
+
+// Built with AVX2 and FMA in NoiseKernelAvx2.cpp
+void deform_vertices_avx2(attribute_span<float[3]> vertices, const NoiseParameters& p) noexcept;
+}
@@ -0,0 +1,167 @@
+#include "Normals.hpp"
+
+#include <Threedim/NormalsKernelImpl.hpp>
+#include <Threedim/ThreadPool.hpp>
+
+#include <cmath>
+
+namespace Threedim
+{
+// Same granularity as the deformation itself
+static constexpr int64_t normals_chunk_size = 16384;
+
+template <typename F>
+static void normals_for_chunks(int64_t count, F&& f)
+{
+  if (count < 4 * normals_chunk_size)
+    f(int64_t(0), count);
+  else
+    ThreadPool::instance().parallel_for(count, normals_chunk_size, f);
+}
+
+static void normals_soup(
+    attribute_span<const float[3]> positions,
+    attribute_span<float[3]> normals,
+    int64_t begin,
+    int64_t end) noexcept
+{
+#if defined(THREEDIM_NOISE_AVX2) && !defined(__AVX2__)
+  if (simd_has_avx2())
+    return normals_soup_avx2(positions, normals, begin, end);
+#endif
+  normals_soup_impl(positions, normals, begin, end);
+}
+
+template <typename Index>
+static void normals_faces(
+    const Index* idx,
+    attribute_span<const float[3]> positions,
+    float* const (&n)[3],
+    int64_t begin,
+    int64_t end) noexcept
+{
+#if defined(THREEDIM_NOISE_AVX2) && !defined(__AVX2__)
+  if (simd_has_avx2())
+    return normals_faces_avx2(idx, positions, n, begin, end);
+#endif
+  normals_faces_impl(idx, positions, n, begin, end);
+}
+
+static void normals_write(float* out, float x, float y, float z) noexcept
+{
+  const float len = std::sqrt(x * x + y * y + z * z);
+  if (len > 1e-20f)
+  {
+    out[0] = x / len;
+    out[1] = y / len;
+    out[2] = z / len;
+  }
+}
+
+void VertexNormals::compute(
+    attribute_span<const float[3]> positions,
+    attribute_span<float[3]> normals)
+{
+  const int64_t faces = std::min(positions.size(), normals.size()) / 3;
+
+  normals_for_chunks(
+      faces,
+      [&](int64_t begin, int64_t end) { normals_soup(positions, normals, begin, end); });
+}
+
+template <typename Index>
+void VertexNormals::rebuild_adjacency(const Index* idx, int64_t vertices)
+{
+  const int64_t faces = m_indexCount / 3;
+
+  // Counting sort of the faces by vertex
+  m_vertexFaceOffsets.assign(vertices + 1, 0);
+  for (int64_t f = 0; f < faces; f++)
+  {
+    const Index* tri = idx + f * 3;
+    if (tri[0] < vertices && tri[1] < vertices && tri[2] < vertices)
+      for (int v = 0; v < 3; v++)
+        m_vertexFaceOffsets[tri[v] + 1]++;
+  }
+
+  for (int64_t v = 0; v < vertices; v++)
+    m_vertexFaceOffsets[v + 1] += m_vertexFaceOffsets[v];
+
+  m_vertexFaces.resize(m_vertexFaceOffsets[vertices]);
+  std::vector<int32_t> cursor(m_vertexFaceOffsets.begin(), m_vertexFaceOffsets.end() - 1);
+  for (int64_t f = 0; f < faces; f++)
+  {
+    const Index* tri = idx + f * 3;
+    if (tri[0] < vertices && tri[1] < vertices && tri[2] < vertices)
+      for (int v = 0; v < 3; v++)
+        m_vertexFaces[cursor[tri[v]]++] = int32_t(f);
+  }
+}
+
+template <typename Index>
+void VertexNormals::face_normals(const Index* idx, attribute_span<const float[3]> positions)
+{
+  const int64_t faces = m_indexCount / 3;
+  m_faceNormals.resize(faces * 3);
+  float* const n[3]{
+      m_faceNormals.data(), m_faceNormals.data() + faces, m_faceNormals.data() + 2 * faces};
+
+  normals_for_chunks(
+      faces,
+      [&](int64_t begin, int64_t end) { normals_faces(idx, positions, n, begin, end); });
+}
+
+void VertexNormals::compute(
+    attribute_span<const float[3]> positions,
+    index_view indices,
+    attribute_span<float[3]> normals)
+{
+  const int64_t vertices = std::min(positions.size(), normals.size());
+  if (vertices <= 0 || indices.count < 3 || !indices.data)
+    return;
+
+  positions = positions.subspan(0, vertices);
+
+  // Topology changed
+  if (indices.dirty || indices.data != m_indexData || indices.count != m_indexCount
+      || indices.uint32 != m_uint32 || vertices != m_vertexCount)
+  {
+    m_indexData = indices.data;
+    m_indexCount = indices.count;
+    m_uint32 = indices.uint32;
+    m_vertexCount = vertices;
+    if (m_uint32)
+      rebuild_adjacency((const uint32_t*)indices.data, vertices);
+    else
+      rebuild_adjacency((const uint16_t*)indices.data, vertices);
+  }
+
+  if (m_uint32)
+    face_normals((const uint32_t*)indices.data, positions);
+  else
+    face_normals((const uint16_t*)indices.data, positions);
+
+  const int64_t faces = m_indexCount / 3;
+  const float* nx = m_faceNormals.data();
+  const float* ny = nx + faces;
+  const float* nz = ny + faces;
+
+  normals_for_chunks(
+      vertices,
+      [&](int64_t begin, int64_t end)
+      {
+        for (int64_t v = begin; v < end; v++)
+        {
+          float x = 0.f, y = 0.f, z = 0.f;
+          for (int32_t i = m_vertexFaceOffsets[v]; i < m_vertexFaceOffsets[v + 1]; i++)
+          {
+            const int32_t f = m_vertexFaces[i];
+            x += nx[f];
+            y += ny[f];
+            z += nz[f];
+          }
+          normals_write(normals[v], x, y, z);
+        }
+      });
+}
+}
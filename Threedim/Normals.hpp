@@ -0,0 +1,62 @@
+#pragma once
+
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <Threedim/AttributeView.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace Threedim
+{
+//! Contents of the index buffer of an indexed triangle list
+struct index_view
+{
+  const void* data{};
+  int64_t count{};
+  bool uint32{};
+  //! The indices changed since the previous call, even if they were edited in place
+  bool dirty{};
+};
+
+/**
+ * @brief Recomputes vertex normals after the positions of a triangle list changed.
+ *
+ * Indexed meshes get smooth, area-weighted normals: the vertex -> face adjacency
+ * is computed once and kept until the index buffer or the vertex count changes,
+ * or the indices are marked dirty, so that each update is a face normal pass
+ * followed by a per-vertex gather, both split across the ThreadPool.
+ * Triangle soups get flat normals.
+ *
+ * Vertices which are not part of any valid face keep their current normal.
+ */
+class VertexNormals
+{
+public:
+  void compute(attribute_span<const float[3]> positions, attribute_span<float[3]> normals);
+
+  void compute(
+      attribute_span<const float[3]> positions,
+      index_view indices,
+      attribute_span<float[3]> normals);
+
+private:
+  template <typename Index>
+  void face_normals(const Index* idx, attribute_span<const float[3]> positions);
+  template <typename Index>
+  void rebuild_adjacency(const Index* idx, int64_t vertices);
+
+  // What the adjacency was computed for
+  const void* m_indexData{};
+  int64_t m_indexCount{-1};
+  int64_t m_vertexCount{-1};
+  bool m_uint32{};
+
+  // For vertex v, its faces are m_vertexFaces[m_vertexFaceOffsets[v] .. m_vertexFaceOffsets[v+1]]
+  std::vector<int32_t> m_vertexFaceOffsets;
+  std::vector<int32_t> m_vertexFaces;
+
+  // Unnormalized face normals, stored as x[faces] y[faces] z[faces]
+  std::vector<float> m_faceNormals;
+};
+}
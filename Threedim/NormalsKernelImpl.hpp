@@ -0,0 +1,132 @@
+#pragma once
+
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+// The vertex normal kernels, included by each translation unit which builds them
+// for an instruction set, like NoiseKernelImpl.hpp. Everything here has internal linkage.
+
+#include <Threedim/AttributeView.hpp>
+#include <Threedim/Simd.hpp>
+
+#include <algorithm>
+#include <cstdint>
+
+namespace Threedim
+{
+namespace
+{
+// (b - a) x (c - a) for 8 triangles at once
+inline void normals_cross(
+    const float (&a)[3][8],
+    const float (&b)[3][8],
+    const float (&c)[3][8],
+    float (&n)[3][8]) noexcept
+{
+  const simd_f32 ux = simd_f32::load(b[0]) - simd_f32::load(a[0]);
+  const simd_f32 uy = simd_f32::load(b[1]) - simd_f32::load(a[1]);
+  const simd_f32 uz = simd_f32::load(b[2]) - simd_f32::load(a[2]);
+  const simd_f32 vx = simd_f32::load(c[0]) - simd_f32::load(a[0]);
+  const simd_f32 vy = simd_f32::load(c[1]) - simd_f32::load(a[1]);
+  const simd_f32 vz = simd_f32::load(c[2]) - simd_f32::load(a[2]);
+
+  (uy * vz - uz * vy).store(n[0]);
+  (uz * vx - ux * vz).store(n[1]);
+  (ux * vy - uy * vx).store(n[2]);
+}
+
+inline void normals_normalize(float (&n)[3][8]) noexcept
+{
+  const simd_f32 x = simd_f32::load(n[0]);
+  const simd_f32 y = simd_f32::load(n[1]);
+  const simd_f32 z = simd_f32::load(n[2]);
+  const simd_f32 len = max(sqrt(x * x + y * y + z * z), simd_f32::broadcast(1e-20f));
+  (x / len).store(n[0]);
+  (y / len).store(n[1]);
+  (z / len).store(n[2]);
+}
+
+// Flat normals of the triangles [begin; end) of a soup
+inline void normals_soup_impl(
+    attribute_span<const float[3]> positions,
+    attribute_span<float[3]> normals,
+    int64_t begin,
+    int64_t end) noexcept
+{
+  for (int64_t f = begin; f < end; f += 8)
+  {
+    const int n = int(std::min(int64_t(8), end - f));
+    alignas(32) float p[3][3][8]{};
+    for (int k = 0; k < n; k++)
+      for (int v = 0; v < 3; v++)
+        for (int c = 0; c < 3; c++)
+          p[v][c][k] = positions[(f + k) * 3 + v][c];
+
+    alignas(32) float fn[3][8];
+    normals_cross(p[0], p[1], p[2], fn);
+    normals_normalize(fn);
+
+    for (int k = 0; k < n; k++)
+    {
+      // Degenerate triangles keep their normals
+      if (fn[0][k] == 0.f && fn[1][k] == 0.f && fn[2][k] == 0.f)
+        continue;
+      for (int v = 0; v < 3; v++)
+        for (int c = 0; c < 3; c++)
+          normals[(f + k) * 3 + v][c] = fn[c][k];
+    }
+  }
+}
+
+// Unnormalized normals of the indexed faces [begin; end), written to n[0..2][face]:
+// larger faces weigh more in the vertex normals
+template <typename Index>
+inline void normals_faces_impl(
+    const Index* idx,
+    attribute_span<const float[3]> positions,
+    float* const (&n)[3],
+    int64_t begin,
+    int64_t end) noexcept
+{
+  const int64_t vertices = positions.size();
+  for (int64_t f = begin; f < end; f += 8)
+  {
+    const int count = int(std::min(int64_t(8), end - f));
+    alignas(32) float p[3][3][8]{};
+    for (int k = 0; k < count; k++)
+    {
+      const Index* tri = idx + (f + k) * 3;
+      // Faces with invalid indices are not in the adjacency: leave them at zero
+      if (tri[0] >= vertices || tri[1] >= vertices || tri[2] >= vertices)
+        continue;
+      for (int v = 0; v < 3; v++)
+        for (int c = 0; c < 3; c++)
+          p[v][c][k] = positions[tri[v]][c];
+    }
+
+    alignas(32) float fn[3][8];
+    normals_cross(p[0], p[1], p[2], fn);
+    for (int c = 0; c < 3; c++)
+      std::copy_n(fn[c], count, n[c] + f);
+  }
+}
+}
+
+// Built with AVX2 and FMA in NoiseKernelAvx2.cpp
+void normals_soup_avx2(
+    attribute_span<const float[3]> positions,
+    attribute_span<float[3]> normals,
+    int64_t begin,
+    int64_t end) noexcept;
+void normals_faces_avx2(
+    const uint16_t* idx,
+    attribute_span<const float[3]> positions,
+    float* const (&n)[3],
+    int64_t begin,
+    int64_t end) noexcept;
+void normals_faces_avx2(
+    const uint32_t* idx,
+    attribute_span<const float[3]> positions,
+    float* const (&n)[3],
+    int64_t begin,
+    int64_t end) noexcept;
+}
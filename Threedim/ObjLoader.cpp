@@ -2,13 +2,18 @@
 
 #include "Ply.hpp"
 
+#include <Threedim/JobSystem.hpp>
+
 #include <QMatrix4x4>
 #include <QString>
 
 namespace Threedim
 {
 
-void ObjLoader::operator()() { }
+void ObjLoader::operator()()
+{
+  m_jobs->apply(*this);
+}
 
 void ObjLoader::rebuild_geometry()
 {
@@ -153,37 +158,44 @@ static bool check_file_extension(std::string_view filename, std::string_view exp
   return true;
 }
 
-std::function<void(ObjLoader&)> ObjLoader::ins::obj_t::process(file_type tv)
+void ObjLoader::load(std::string filename, std::string bytes)
 {
-  auto upload = [](auto&& mesh, auto&& buf)
-  {
-    return [mesh = std::move(mesh), buf = std::move(buf)](ObjLoader& o) mutable
-    {
-      // This part happens in the execution thread
-      std::swap(o.meshinfo, mesh);
-      std::swap(o.complete, buf);
-
-      o.rebuild_geometry();
-    };
-  };
+  JobSystem::instance().submit(
+      m_jobs.get(),
+      job_priority::background,
+      [jobs = m_jobs, filename = std::move(filename), bytes = std::move(bytes)]
+      {
+        // This part happens in a JobSystem thread
+        Threedim::float_vec buf;
+        std::vector<mesh> meshes;
+        if (check_file_extension(filename, "obj"))
+          meshes = Threedim::ObjFromString(bytes, buf);
+        else if (check_file_extension(filename, "ply"))
+          meshes = Threedim::PlyFromFile(filename, buf);
+        if (meshes.empty())
+          return;
+
+        jobs->post(
+            [meshes = std::move(meshes), buf = std::move(buf)](ObjLoader& o) mutable
+            {
+              // This part happens in the execution thread
+              std::swap(o.meshinfo, meshes);
+              std::swap(o.complete, buf);
+
+              o.rebuild_geometry();
+            });
+      });
+}
 
-  Threedim::float_vec buf;
+std::function<void(ObjLoader&)> ObjLoader::ins::obj_t::process(file_type tv)
+{
+  // The file port only hands the file over: it is parsed in the JobSystem.
+  // The views of tv do not outlive this call, PLY files are read from their path.
+  std::string bytes;
   if (check_file_extension(tv.filename, "obj"))
-  {
-    // This part happens in a separate thread
-    if (auto mesh = Threedim::ObjFromString(tv.bytes, buf); !mesh.empty())
-    {
-      return upload(std::move(mesh), std::move(buf));
-    }
-  }
-  else if (check_file_extension(tv.filename, "ply"))
-  {
-    // This part happens in a separate thread
-    if (auto mesh = Threedim::PlyFromFile(tv.filename, buf); !mesh.empty())
-    {
-      return upload(std::move(mesh), std::move(buf));
-    }
-  }
-  return {};
+    bytes = tv.bytes;
+
+  return [filename = std::string(tv.filename), bytes = std::move(bytes)](
+             ObjLoader& o) mutable { o.load(std::move(filename), std::move(bytes)); };
 }
 }
@@ -1,4 +1,5 @@
 #pragma once
+#include <Threedim/JobSystem.hpp>
 #include <Threedim/TinyObj.hpp>
 #include <halp/controls.hpp>
 #include <halp/file_port.hpp>
@@ -6,6 +7,9 @@
 #include <halp/meta.hpp>
 #include <ossia/detail/mutex.hpp>
 
+#include <memory>
+#include <string>
+
 namespace Threedim
 {
 
@@ -46,8 +50,13 @@ public:
 
   void rebuild_geometry();
 
+  // Parses the file in the JobSystem, the meshes are applied at the next tick
+  void load(std::string filename, std::string bytes);
+
   std::vector<mesh> meshinfo{};
   float_vec complete;
+  std::shared_ptr<job_mailbox<ObjLoader>> m_jobs
+      = std::make_shared<job_mailbox<ObjLoader>>();
 };
 
 }
@@ -1,5 +1,6 @@
 #include "Primitive.hpp"
 
+#include <Threedim/JobSystem.hpp>
 #include <Threedim/MeshHelpers.hpp>
 #include <Threedim/TinyObj.hpp>
 
@@ -9,7 +10,7 @@
 namespace Threedim
 {
 
-void loadTriMesh(TMesh& mesh, std::vector<float>& complete, PrimitiveOutputs& outputs)
+void meshToBuffer(TMesh& mesh, std::vector<float>& complete)
 {
   vcg::tri::Clean<TMesh>::RemoveUnreferencedVertex(mesh);
   vcg::tri::Clean<TMesh>::RemoveZeroAreaFace(mesh);
@@ -91,6 +92,11 @@ void loadTriMesh(TMesh& mesh, std::vector<float>& complete, PrimitiveOutputs& ou
     (*uv_start++) = p2.X();
     (*uv_start++) = p2.Y();
   }
+}
+
+void bufferToOutputs(std::vector<float>& complete, PrimitiveOutputs& outputs)
+{
+  const auto vertices = complete.size() / (3 + 3 + 2);
   outputs.geometry.mesh.buffers.main_buffer.data = complete.data();
   outputs.geometry.mesh.buffers.main_buffer.size = complete.size();
   outputs.geometry.mesh.buffers.main_buffer.dirty = true;
@@ -102,7 +108,43 @@ void loadTriMesh(TMesh& mesh, std::vector<float>& complete, PrimitiveOutputs& ou
   outputs.geometry.dirty_mesh = true;
 }
 
+void loadTriMesh(TMesh& mesh, std::vector<float>& complete, PrimitiveOutputs& outputs)
+{
+  meshToBuffer(mesh, complete);
+  bufferToOutputs(complete, outputs);
+}
+
 static thread_local TMesh mesh;
+
+void Primitive::generate(std::function<void(TMesh&)> make_mesh)
+{
+  JobSystem::instance().submit(
+      m_jobs.get(),
+      JobSystem::priority_since(m_lastTick),
+      [jobs = m_jobs, make_mesh = std::move(make_mesh)]
+      {
+        // This part happens in a JobSystem thread
+        mesh.Clear();
+        make_mesh(mesh);
+
+        std::vector<float> buf;
+        meshToBuffer(mesh, buf);
+        jobs->post(
+            [buf = std::move(buf)](Primitive& p) mutable
+            {
+              // This part happens in the execution thread
+              std::swap(p.complete, buf);
+              bufferToOutputs(p.complete, p.outputs);
+            });
+      });
+}
+
+void Primitive::operator()()
+{
+  m_lastTick = std::chrono::steady_clock::now();
+  m_jobs->apply(*this);
+}
+
 void Plane::update()
 {
   /*
@@ -129,54 +171,57 @@ void Plane::update()
   outputs.geometry.mesh.vertices = 4;
   outputs.geometry.dirty_mesh = true;
   */
-  mesh.Clear();
-  vcg::tri::Grid(mesh, inputs.hdivs, inputs.vdivs, 1., 1.);
-  loadTriMesh(mesh, complete, outputs);
+  generate([h = inputs.hdivs.value, v = inputs.vdivs.value](TMesh& mesh)
+           { vcg::tri::Grid(mesh, h, v, 1., 1.); });
 }
 
 void Cube::update()
 {
-  mesh.Clear();
-  vcg::Box3<float> box;
-  box.min = {-1, -1, -1};
-  box.max = {1, 1, 1};
-  vcg::tri::Box(mesh, box);
-  loadTriMesh(mesh, complete, outputs);
+  generate(
+      [](TMesh& mesh)
+      {
+        vcg::Box3<float> box;
+        box.min = {-1, -1, -1};
+        box.max = {1, 1, 1};
+        vcg::tri::Box(mesh, box);
+      });
 }
 
 void Sphere::update()
 {
-  mesh.Clear();
-  vcg::tri::Sphere(mesh, inputs.subdiv);
-  loadTriMesh(mesh, complete, outputs);
+  generate([subdiv = inputs.subdiv.value](TMesh& mesh)
+           { vcg::tri::Sphere(mesh, subdiv); });
 }
 
 void Icosahedron::update()
 {
-  mesh.Clear();
-  vcg::tri::Icosahedron(mesh);
-  loadTriMesh(mesh, complete, outputs);
+  generate([](TMesh& mesh) { vcg::tri::Icosahedron(mesh); });
 }
 
 void Cone::update()
 {
-  mesh.Clear();
-  vcg::tri::Cone(mesh, inputs.r1, inputs.r2, inputs.h, inputs.subdiv);
-  loadTriMesh(mesh, complete, outputs);
+  generate(
+      [r1 = inputs.r1.value,
+       r2 = inputs.r2.value,
+       h = inputs.h.value,
+       subdiv = inputs.subdiv.value](TMesh& mesh)
+      { vcg::tri::Cone(mesh, r1, r2, h, subdiv); });
 }
 
 void Cylinder::update()
 {
-  mesh.Clear();
-  vcg::tri::Cylinder(inputs.slices, inputs.stacks, mesh, true);
-  loadTriMesh(mesh, complete, outputs);
+  generate([slices = inputs.slices.value, stacks = inputs.stacks.value](TMesh& mesh)
+           { vcg::tri::Cylinder(slices, stacks, mesh, true); });
 }
 
 void Torus::update()
 {
-  mesh.Clear();
-  vcg::tri::Torus(mesh, inputs.r1, inputs.r2, inputs.hdiv, inputs.vdiv);
-  loadTriMesh(mesh, complete, outputs);
+  generate(
+      [r1 = inputs.r1.value,
+       r2 = inputs.r2.value,
+       hdiv = inputs.hdiv.value,
+       vdiv = inputs.vdiv.value](TMesh& mesh)
+      { vcg::tri::Torus(mesh, r1, r2, hdiv, vdiv); });
 }
 
 }
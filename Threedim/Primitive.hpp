@@ -1,21 +1,33 @@
 #pragma once
 
+#include <Threedim/JobSystem.hpp>
 #include <Threedim/TinyObj.hpp>
 #include <halp/audio.hpp>
 #include <halp/geometry.hpp>
 #include <halp/meta.hpp>
 
+#include <memory>
+
 namespace Threedim
 {
+class TMesh;
+
 struct Primitive
 {
   halp_meta(category, "Visuals/3D/Primitives")
   halp_meta(author, "Jean-Michaël Celerier, vcglib")
   halp_meta(manual_url, "https://ossia.io/score-docs/processes/meshes.html#primitive")
 
-  void operator()() { }
+  void operator()();
   PrimitiveOutputs outputs;
   std::vector<float> complete;
+
+  // Builds the mesh in the JobSystem: make_mesh is called there on an empty mesh,
+  // and the result is applied at the next tick
+  void generate(std::function<void(TMesh&)> make_mesh);
+  std::shared_ptr<job_mailbox<Primitive>> m_jobs
+      = std::make_shared<job_mailbox<Primitive>>();
+  std::chrono::steady_clock::time_point m_lastTick;
 };
 
 struct Plane : Primitive
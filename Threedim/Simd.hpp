@@ -0,0 +1,212 @@
+#pragma once
+
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// The instruction set is part of the mangled names: translation units built
+// with other flags, such as NoiseKernelAvx2.cpp, get their own definitions.
+#if defined(__AVX2__)
+#define THREEDIM_SIMD_ISA simd_avx2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define THREEDIM_SIMD_ISA simd_neon
+#else
+#define THREEDIM_SIMD_ISA simd_scalar
+#endif
+
+namespace Threedim
+{
+#if defined(THREEDIM_NOISE_AVX2) && !defined(__AVX2__)
+//! The CPU can run the kernels of NoiseKernelAvx2.cpp, built with AVX2 and FMA
+bool simd_has_avx2() noexcept;
+#endif
+
+inline namespace THREEDIM_SIMD_ISA
+{
+// 8 floats, one per vertex or face being processed.
+// Picks AVX2, AArch64 NEON or plain loops at build time.
+#if defined(__AVX2__)
+struct simd_f32
+{
+  __m256 v;
+
+  static simd_f32 load(const float* p) noexcept { return {_mm256_load_ps(p)}; }
+  static simd_f32 broadcast(float f) noexcept { return {_mm256_set1_ps(f)}; }
+  void store(float* p) const noexcept { _mm256_store_ps(p, v); }
+
+  friend simd_f32 operator+(simd_f32 a, simd_f32 b) noexcept
+  {
+    return {_mm256_add_ps(a.v, b.v)};
+  }
+  friend simd_f32 operator-(simd_f32 a, simd_f32 b) noexcept
+  {
+    return {_mm256_sub_ps(a.v, b.v)};
+  }
+  friend simd_f32 operator*(simd_f32 a, simd_f32 b) noexcept
+  {
+    return {_mm256_mul_ps(a.v, b.v)};
+  }
+  friend simd_f32 operator/(simd_f32 a, simd_f32 b) noexcept
+  {
+    return {_mm256_div_ps(a.v, b.v)};
+  }
+  friend simd_f32 min(simd_f32 a, simd_f32 b) noexcept
+  {
+    return {_mm256_min_ps(a.v, b.v)};
+  }
+  friend simd_f32 max(simd_f32 a, simd_f32 b) noexcept
+  {
+    return {_mm256_max_ps(a.v, b.v)};
+  }
+  friend simd_f32 floor(simd_f32 a) noexcept { return {_mm256_floor_ps(a.v)}; }
+  friend simd_f32 sqrt(simd_f32 a) noexcept { return {_mm256_sqrt_ps(a.v)}; }
+
+  // idx contains non-negative integral values, within the bounds of table
+  friend simd_f32 gather(const float* table, simd_f32 idx) noexcept
+  {
+    return {_mm256_i32gather_ps(table, _mm256_cvttps_epi32(idx.v), 4)};
+  }
+};
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+struct simd_f32
+{
+  float32x4_t lo, hi;
+
+  static simd_f32 load(const float* p) noexcept { return {vld1q_f32(p), vld1q_f32(p + 4)}; }
+  static simd_f32 broadcast(float f) noexcept { return {vdupq_n_f32(f), vdupq_n_f32(f)}; }
+  void store(float* p) const noexcept
+  {
+    vst1q_f32(p, lo);
+    vst1q_f32(p + 4, hi);
+  }
+
+  friend simd_f32 operator+(simd_f32 a, simd_f32 b) noexcept
+  {
+    return {vaddq_f32(a.lo, b.lo), vaddq_f32(a.hi, b.hi)};
+  }
+  friend simd_f32 operator-(simd_f32 a, simd_f32 b) noexcept
+  {
+    return {vsubq_f32(a.lo, b.lo), vsubq_f32(a.hi, b.hi)};
+  }
+  friend simd_f32 operator*(simd_f32 a, simd_f32 b) noexcept
+  {
+    return {vmulq_f32(a.lo, b.lo), vmulq_f32(a.hi, b.hi)};
+  }
+  friend simd_f32 operator/(simd_f32 a, simd_f32 b) noexcept
+  {
+    return {vdivq_f32(a.lo, b.lo), vdivq_f32(a.hi, b.hi)};
+  }
+  friend simd_f32 min(simd_f32 a, simd_f32 b) noexcept
+  {
+    return {vminq_f32(a.lo, b.lo), vminq_f32(a.hi, b.hi)};
+  }
+  friend simd_f32 max(simd_f32 a, simd_f32 b) noexcept
+  {
+    return {vmaxq_f32(a.lo, b.lo), vmaxq_f32(a.hi, b.hi)};
+  }
+  friend simd_f32 floor(simd_f32 a) noexcept
+  {
+    return {vrndmq_f32(a.lo), vrndmq_f32(a.hi)};
+  }
+  friend simd_f32 sqrt(simd_f32 a) noexcept
+  {
+    return {vsqrtq_f32(a.lo), vsqrtq_f32(a.hi)};
+  }
+
+  // NEON has no gather instruction
+  friend simd_f32 gather(const float* table, simd_f32 idx) noexcept
+  {
+    alignas(16) int32_t i[8];
+    vst1q_s32(i, vcvtq_s32_f32(idx.lo));
+    vst1q_s32(i + 4, vcvtq_s32_f32(idx.hi));
+
+    alignas(16) float res[8];
+    for (int k = 0; k < 8; k++)
+      res[k] = table[i[k]];
+    return load(res);
+  }
+};
+#else
+struct simd_f32
+{
+  float v[8];
+
+  static simd_f32 load(const float* p) noexcept
+  {
+    simd_f32 r;
+    std::copy_n(p, 8, r.v);
+    return r;
+  }
+  static simd_f32 broadcast(float f) noexcept
+  {
+    simd_f32 r;
+    std::fill_n(r.v, 8, f);
+    return r;
+  }
+  void store(float* p) const noexcept { std::copy_n(v, 8, p); }
+
+  template <typename F>
+  friend simd_f32 apply(simd_f32 a, simd_f32 b, F f) noexcept
+  {
+    simd_f32 r;
+    for (int k = 0; k < 8; k++)
+      r.v[k] = f(a.v[k], b.v[k]);
+    return r;
+  }
+  friend simd_f32 operator+(simd_f32 a, simd_f32 b) noexcept
+  {
+    return apply(a, b, [](float x, float y) { return x + y; });
+  }
+  friend simd_f32 operator-(simd_f32 a, simd_f32 b) noexcept
+  {
+    return apply(a, b, [](float x, float y) { return x - y; });
+  }
+  friend simd_f32 operator*(simd_f32 a, simd_f32 b) noexcept
+  {
+    return apply(a, b, [](float x, float y) { return x * y; });
+  }
+  friend simd_f32 operator/(simd_f32 a, simd_f32 b) noexcept
+  {
+    return apply(a, b, [](float x, float y) { return x / y; });
+  }
+  friend simd_f32 min(simd_f32 a, simd_f32 b) noexcept
+  {
+    return apply(a, b, [](float x, float y) { return x < y ? x : y; });
+  }
+  friend simd_f32 max(simd_f32 a, simd_f32 b) noexcept
+  {
+    return apply(a, b, [](float x, float y) { return x > y ? x : y; });
+  }
+  friend simd_f32 floor(simd_f32 a) noexcept
+  {
+    simd_f32 r;
+    for (int k = 0; k < 8; k++)
+      r.v[k] = std::floor(a.v[k]);
+    return r;
+  }
+  friend simd_f32 sqrt(simd_f32 a) noexcept
+  {
+    simd_f32 r;
+    for (int k = 0; k < 8; k++)
+      r.v[k] = std::sqrt(a.v[k]);
+    return r;
+  }
+  friend simd_f32 gather(const float* table, simd_f32 idx) noexcept
+  {
+    simd_f32 r;
+    for (int k = 0; k < 8; k++)
+      r.v[k] = table[int32_t(idx.v[k])];
+    return r;
+  }
+};
+#endif
+}
+}
@@ -1,20 +1,106 @@
 #include "StructureSynth.hpp"
 
-#include <Threedim/TinyObj.hpp>
+#include <Threedim/SynthCache.hpp>
+#include <Threedim/SynthRenderer.hpp>
 #include <ssynth/Model/Builder.h>
-#include <ssynth/Model/Rendering/ObjRenderer.h>
 #include <ssynth/Parser/EisenParser.h>
 #include <ssynth/Parser/Preprocessor.h>
 #include <ssynth/Parser/Tokenizer.h>
 
+#include <QCryptographicHash>
 #include <QDebug>
 #include <QString>
 
+#include <algorithm>
+#include <cstddef>
 #include <iostream>
 
 namespace Threedim
 {
-static auto CreateObj(const QString& input)
+// Progressive builds publish their geometry at least this often
+static constexpr int64_t synth_publish_objects = 20000;
+static constexpr auto synth_publish_interval = std::chrono::milliseconds(100);
+
+// Tessellation of the spheres
+static constexpr int synth_sphere_dt = 10;
+static constexpr int synth_sphere_dp = 10;
+
+// Identifies the geometry of a program in the SynthCache
+static QByteArray synth_cache_key(const QString& preprocessed, const synth_options& opts)
+{
+  QCryptographicHash h{QCryptographicHash::Sha256};
+  h.addData(preprocessed.toUtf8());
+
+  // The budget is fitted to each published part of a progressive build,
+  // which does not keep the same primitives as a whole build
+  const bool progressive_budget = opts.triangle_budget > 0 && opts.progress;
+  const int64_t settings[]
+      = {opts.instanced,
+         opts.seed,
+         opts.triangle_budget,
+         progressive_budget,
+         synth_sphere_dt,
+         synth_sphere_dp};
+  h.addData(QByteArrayView{reinterpret_cast<const char*>(settings), sizeof(settings)});
+  return h.result();
+}
+
+// libssynth keeps its random streams and its logging in globals, and the "seed"
+// command reseeds them: two builds running at once would draw from the same
+// streams. Until the Builder has its own generator, parsing and building happen
+// one at a time for the whole addon, so that a seed always gives the same model.
+// They have their own thread instead of waiting for each other in the workers
+// of JobSystem::instance(), which would starve the jobs of the other nodes.
+// The rule expansion is serial: only the tessellation of its primitives runs
+// in parallel, in SynthRenderer.
+static JobSystem& synth_builds()
+{
+  static JobSystem builds{"structure synth", 1};
+  return builds;
+}
+
+// Changes of the seed or of the renderer settings do not require parsing again.
+// The last parsed programs are kept, most recently used first, so that several
+// nodes do not evict each other. Only used in the thread of synth_builds().
+static constexpr std::size_t synth_parsed_capacity = 8;
+
+struct synth_parsed
+{
+  //! Hash of the preprocessed program
+  QByteArray hash;
+  std::shared_ptr<ssynth::Model::RuleSet> rules;
+};
+static std::vector<synth_parsed> synth_parsed_programs;
+
+static std::shared_ptr<ssynth::Model::RuleSet>
+synth_parse(const QString& preprocessed, const QByteArray& hash)
+{
+  auto& cache = synth_parsed_programs;
+  auto it = std::find_if(
+      cache.begin(), cache.end(), [&](const synth_parsed& p) { return p.hash == hash; });
+  if (it != cache.end())
+  {
+    std::rotate(cache.begin(), it, it + 1);
+    return cache.front().rules;
+  }
+
+  // Only kept once the names are resolved: the Builder cannot run otherwise
+  ssynth::Parser::Tokenizer t{preprocessed};
+  ssynth::Parser::EisenParser e{t};
+  std::shared_ptr<ssynth::Model::RuleSet> rules{e.parseRuleset()};
+  rules->resolveNames();
+
+  if (cache.size() >= synth_parsed_capacity)
+    cache.pop_back();
+  cache.insert(cache.begin(), synth_parsed{hash, rules});
+  return rules;
+}
+
+static bool CreateMesh(
+    const QString& input,
+    const synth_options& opts,
+    const synth_generation& gen,
+    synth_mesh& out)
 try
 {
   /*
@@ -33,63 +119,315 @@ rule R1 w 10 {
 )_";
 */
   ssynth::Parser::Preprocessor p;
-  auto preprocessed = p.Process(input);
+  const auto preprocessed = p.Process(input);
+  const QByteArray hash = QCryptographicHash::hash(preprocessed.toUtf8(), QCryptographicHash::Sha256);
 
-  ssynth::Parser::Tokenizer t{std::move(preprocessed)};
-  ssynth::Parser::EisenParser e{t};
+  // Built before with the same program and settings: skip parsing, building and meshing
+  const QByteArray key = synth_cache_key(preprocessed, opts);
+  if (SynthCache::instance().find(key, out))
+    return true;
+
+  // Triangles are written directly in the output buffer
+  SynthRenderer renderer{synth_sphere_dt, synth_sphere_dp, opts.instanced};
+  renderer.cancel_when(gen.latest.get(), gen.id);
+  renderer.set_triangle_budget(opts.triangle_budget);
 
-  auto ruleset = std::unique_ptr<ssynth::Model::RuleSet>{e.parseRuleset()};
-  ruleset->resolveNames();
-  ruleset->dumpInfo();
+  // What was published is also kept for the cache
+  synth_mesh published;
+  if (opts.progress)
+  {
+    renderer.publish_every(
+        synth_publish_objects,
+        synth_publish_interval,
+        [&](const synth_mesh& m)
+        {
+          opts.progress->publish(gen.id, m);
+          published.append(m);
+        });
+  }
 
-  ssynth::Model::Rendering::ObjRenderer obj{10, 10, true, false};
-  ssynth::Model::Builder b(&obj, ruleset.get(), true);
-  b.build();
+  const auto rules = synth_parse(preprocessed, hash);
 
-  QByteArray data;
+  ssynth::Model::Builder b(&renderer, rules.get(), true);
+  // Same as "set seed" in the program, which still takes precedence
+  b.setCommand("seed", QString::number(opts.seed));
+  try
   {
-    QTextStream ts(&data);
-    obj.writeToStream(ts);
-    ts.flush();
+    b.build();
+  }
+  catch (const synth_cancelled&)
+  {
+    throw;
+  }
+  catch (...)
+  {
+    // Parsed again next time, in case the failure left the rule set unusable
+    std::erase_if(
+        synth_parsed_programs, [&](const synth_parsed& p) { return p.hash == hash; });
+    throw;
   }
 
-  return data.toStdString();
+  if (gen.stale())
+    return false;
+
+  // With progressive builds, this is only what was not published yet
+  renderer.finish(out);
+
+  if (opts.progress)
+  {
+    published.append(out);
+    SynthCache::instance().insert(key, published);
+  }
+  else
+  {
+    SynthCache::instance().insert(key, out);
+  }
+  return true;
+}
+catch (const synth_cancelled&)
+{
+  return false;
 }
 catch (const std::exception& e)
 {
   qDebug() << e.what();
-  return std::string{};
+  return false;
 }
 catch (...)
 {
-  return std::string{};
+  return false;
 }
 
-void StrucSynth::operator()() { }
+static halp::dynamic_geometry synth_geometry(synth_mesh& mesh)
+{
+  const int64_t vertices = mesh.positions.size() / 3;
+
+  halp::dynamic_geometry geom;
+  geom.topology = halp::dynamic_geometry::triangles;
+  geom.cull_mode = halp::dynamic_geometry::back;
+  geom.front_face = halp::dynamic_geometry::counter_clockwise;
+  geom.vertices = vertices;
+
+  for (float_vec* data : {&mesh.positions, &mesh.normals})
+  {
+    geom.buffers.push_back(halp::dynamic_geometry::buffer{
+        .data = data->data(),
+        .size = int64_t(data->size() * sizeof(float)),
+        .dirty = true});
+    geom.bindings.push_back(halp::dynamic_geometry::binding{
+        .stride = 3 * sizeof(float),
+        .step_rate = 1,
+        .classification = halp::dynamic_geometry::binding::per_vertex});
+  }
+
+  geom.attributes.push_back(halp::dynamic_geometry::attribute{
+      .binding = 0,
+      .location = halp::dynamic_geometry::attribute::position,
+      .format = halp::dynamic_geometry::attribute::float3,
+      .offset = 0});
+  geom.attributes.push_back(halp::dynamic_geometry::attribute{
+      .binding = 1,
+      .location = halp::dynamic_geometry::attribute::normal,
+      .format = halp::dynamic_geometry::attribute::float3,
+      .offset = 0});
 
-std::function<void(StrucSynth&)> StrucSynth::worker::work(std::string_view in)
+  using input_t = struct halp::dynamic_geometry::input;
+  geom.input.push_back(input_t{.buffer = 0, .offset = 0});
+  geom.input.push_back(input_t{.buffer = 1, .offset = 0});
+
+  // RGBA8 per vertex: a quarter of the size of float colors
+  if (!mesh.colors.empty())
+  {
+    geom.buffers.push_back(halp::dynamic_geometry::buffer{
+        .data = mesh.colors.data(),
+        .size = int64_t(mesh.colors.size() * sizeof(uint32_t)),
+        .dirty = true});
+    geom.bindings.push_back(halp::dynamic_geometry::binding{
+        .stride = sizeof(uint32_t),
+        .step_rate = 1,
+        .classification = halp::dynamic_geometry::binding::per_vertex});
+    geom.attributes.push_back(halp::dynamic_geometry::attribute{
+        .binding = 2,
+        .location = halp::dynamic_geometry::attribute::color,
+        .format = halp::dynamic_geometry::attribute::unormalized4,
+        .offset = 0});
+    geom.input.push_back(input_t{.buffer = 2, .offset = 0});
+  }
+  return geom;
+}
+
+// Adds a per-instance binding with the layout of instance_data
+static void synth_add_instances(halp::dynamic_geometry& geom, float_vec& instances)
 {
-  if (in.empty())
-    return {};
+  using attribute = halp::dynamic_geometry::attribute;
+  using location_t = decltype(attribute::location);
 
-  auto input = CreateObj(QString::fromUtf8(in.data(), in.size()));
-  if (input.empty())
+  geom.buffers.push_back(halp::dynamic_geometry::buffer{
+      .data = instances.data(),
+      .size = int64_t(instances.size() * sizeof(float)),
+      .dirty = true});
+
+  geom.bindings.push_back(halp::dynamic_geometry::binding{
+      .stride = sizeof(instance_data),
+      .step_rate = 1,
+      .classification = halp::dynamic_geometry::binding::per_instance});
+  const int binding = geom.bindings.size() - 1;
+
+  for (int col = 0; col < 4; col++)
+  {
+    geom.attributes.push_back(attribute{
+        .binding = binding,
+        .location = location_t(instance_attribute::transform + col),
+        .format = attribute::float4,
+        .offset = int32_t(col * 4 * sizeof(float))});
+  }
+  geom.attributes.push_back(attribute{
+      .binding = binding,
+      .location = location_t(instance_attribute::color),
+      .format = attribute::float4,
+      .offset = offsetof(instance_data, color)});
+
+  using input_t = struct halp::dynamic_geometry::input;
+  geom.input.push_back(input_t{.buffer = int(geom.buffers.size() - 1), .offset = 0});
+
+  geom.instances = instances.size() / instance_floats;
+}
+
+// Unit meshes with a white color per vertex, so that all the parts of an
+// instanced model have the same layout
+static synth_mesh synth_unit_mesh(synth_mesh mesh)
+{
+  mesh.colors.assign(mesh.positions.size() / 3, 0xffffffff);
+  return mesh;
+}
+
+void StrucSynth::rebuild_geometry()
+{
+  auto& meshes = outputs.geometry.mesh;
+  meshes.clear();
+
+  if (m_mesh.boxes.empty() && m_mesh.spheres.empty())
+  {
+    if (!m_mesh.positions.empty())
+      meshes.push_back(synth_geometry(m_mesh));
+    outputs.geometry.dirty_mesh = true;
+    return;
+  }
+
+  // Instanced models are made of one mesh per kind of primitive, all with the
+  // same layout: ModelDisplay draws them with the same pipeline.
+  // The triangles are a single instance.
+  if (!m_mesh.positions.empty())
+  {
+    if (m_identity.empty())
+    {
+      const instance_data identity{
+          .transform = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1},
+          .color = {1, 1, 1, 1}};
+      const auto* f = reinterpret_cast<const float*>(&identity);
+      m_identity.assign(f, f + instance_floats);
+    }
+    meshes.push_back(synth_geometry(m_mesh));
+    synth_add_instances(meshes.back(), m_identity);
+  }
+  if (!m_mesh.boxes.empty())
+  {
+    if (m_boxMesh.empty())
+      m_boxMesh = synth_unit_mesh(SynthRenderer::unit_box());
+    meshes.push_back(synth_geometry(m_boxMesh));
+    synth_add_instances(meshes.back(), m_mesh.boxes);
+  }
+  if (!m_mesh.spheres.empty())
+  {
+    if (m_sphereMesh.empty())
+      m_sphereMesh = synth_unit_mesh(
+          SynthRenderer::unit_sphere(synth_sphere_dt, synth_sphere_dp));
+    meshes.push_back(synth_geometry(m_sphereMesh));
+    synth_add_instances(meshes.back(), m_mesh.spheres);
+  }
+
+  outputs.geometry.dirty_mesh = true;
+}
+
+void StrucSynth::request_build()
+{
+  m_pendingEdit = false;
+  const uint64_t id = m_generation->fetch_add(1, std::memory_order_relaxed) + 1;
+
+  // A build of this node which did not start yet is replaced
+  synth_builds().submit(
+      m_jobs.get(),
+      JobSystem::priority_since(m_lastTick),
+      [jobs = m_jobs,
+       program = inputs.program.value,
+       opts = synth_options{
+           .instanced = inputs.instanced.value,
+           .seed = inputs.seed.value,
+           .triangle_budget = inputs.budget.value,
+           .progress = inputs.progressive.value ? m_progress : nullptr},
+       gen = synth_generation{m_generation, id}]
+      {
+        if (auto f = build(program, opts, gen))
+          jobs->post(std::move(f));
+      });
+}
+
+void StrucSynth::apply_geometry(uint64_t gen, synth_mesh& mesh)
+{
+  // A newer program was requested while this one was being built
+  if (gen != m_generation->load(std::memory_order_relaxed))
+    return;
+
+  // The first geometry of a build replaces the previous model
+  if (gen != m_meshGeneration)
+  {
+    if (mesh.empty())
+      return;
+    std::swap(m_mesh, mesh);
+    m_meshGeneration = gen;
+  }
+  else if (!mesh.empty())
+  {
+    m_mesh.append(mesh);
+  }
+  else
+  {
+    return;
+  }
+
+  rebuild_geometry();
+}
+
+void StrucSynth::operator()()
+{
+  m_lastTick = std::chrono::steady_clock::now();
+  if (m_pendingEdit && std::chrono::steady_clock::now() - m_lastEdit >= debounce)
+    request_build();
+
+  uint64_t gen{};
+  if (m_progress->take(gen, m_chunk))
+    apply_geometry(gen, m_chunk);
+
+  m_jobs->apply(*this);
+}
+
+std::function<void(StrucSynth&)>
+StrucSynth::build(std::string_view in, synth_options opts, synth_generation gen)
+{
+  // Requests queued behind a newer one are not even parsed
+  if (in.empty() || gen.stale())
     return {};
 
-  Threedim::float_vec buf;
-  if (auto mesh = Threedim::ObjFromString(input, buf); !mesh.empty())
+  synth_mesh res;
+  if (CreateMesh(QString::fromUtf8(in.data(), in.size()), opts, gen, res))
   {
-    return [b = std::move(buf)](StrucSynth& s) mutable
+    return [res = std::move(res), gen = gen.id](StrucSynth& s) mutable
     {
-      std::swap(b, s.m_vertexData);
-      s.outputs.geometry.mesh.buffers.main_buffer.data = s.m_vertexData.data();
-      s.outputs.geometry.mesh.buffers.main_buffer.size = s.m_vertexData.size();
-      s.outputs.geometry.mesh.buffers.main_buffer.dirty = true;
-
-      s.outputs.geometry.mesh.input.input1.offset
-          = sizeof(float) * (s.m_vertexData.size() / 2);
-      s.outputs.geometry.mesh.vertices = s.m_vertexData.size() / (2 * 3);
-      s.outputs.geometry.dirty_mesh = true;
+      // Everything published so far comes before the rest of the model
+      uint64_t published{};
+      if (s.m_progress->take(published, s.m_chunk))
+        s.apply_geometry(published, s.m_chunk);
+      s.apply_geometry(gen, res);
     };
   }
   else
@@ -1,6 +1,7 @@
 #pragma once
 
-#include <Threedim/TinyObj.hpp>
+#include <Threedim/JobSystem.hpp>
+#include <Threedim/SynthMesh.hpp>
 #include <boost/container/vector.hpp>
 #include <halp/controls.hpp>
 #include <halp/geometry.hpp>
@@ -8,10 +9,36 @@
 #include <ossia/detail/mutex.hpp>
 #include <ossia/detail/pod_vector.hpp>
 
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <thread>
 
 namespace Threedim
 {
+//! Identifies a build request: it is stale as soon as a newer one was made
+struct synth_generation
+{
+  std::shared_ptr<const std::atomic<uint64_t>> latest;
+  uint64_t id{};
+
+  bool stale() const noexcept
+  {
+    return latest->load(std::memory_order_relaxed) != id;
+  }
+};
+
+//! How a program is turned into geometry
+struct synth_options
+{
+  bool instanced{};
+  int seed{};
+  //! Maximum number of triangles, 0 for unlimited
+  int64_t triangle_budget{};
+
+  //! Set for progressive builds: receives the geometry while it is built
+  std::shared_ptr<synth_progress> progress;
+};
 
 class StrucSynth
 {
@@ -27,8 +54,12 @@ public:
     struct : halp::lineedit<"Program", "">
     {
       halp_meta(language, "eisenscript")
-      // Request a computation according to the currently defined program
-      void update(StrucSynth& g) { g.worker.request(this->value); }
+      // Edits are only built once the text stops changing
+      void update(StrucSynth& g)
+      {
+        g.m_pendingEdit = true;
+        g.m_lastEdit = std::chrono::steady_clock::now();
+      }
     } program;
 
     PositionControl position;
@@ -36,8 +67,30 @@ public:
     ScaleControl scale;
     struct : halp::impulse_button<"Regenerate">
     {
-      void update(StrucSynth& g) { g.inputs.program.update(g); }
+      void update(StrucSynth& g) { g.request_build(); }
     } regen;
+
+    // Boxes and spheres as instances of a unit mesh instead of triangles.
+    // Each kind of primitive is then a separate mesh of the output.
+    struct : halp::toggle<"Instanced">
+    {
+      void update(StrucSynth& g) { g.request_build(); }
+    } instanced;
+
+    // Sweeping the seed only rebuilds: the program is not parsed again
+    struct : halp::spinbox_i32<"Seed", halp::range{0, 1'000'000, 0}>
+    {
+      void update(StrucSynth& g) { g.request_build(); }
+    } seed;
+
+    // Display large models while they are being built
+    halp::toggle<"Progressive"> progressive;
+
+    // 0 for unlimited. Otherwise spheres are tessellated according to their size.
+    struct : halp::spinbox_i32<"Triangle budget", halp::range{0, 100'000'000, 0}>
+    {
+      void update(StrucSynth& g) { g.request_build(); }
+    } budget;
   } inputs;
 
   struct
@@ -45,23 +98,49 @@ public:
     struct : halp::mesh
     {
       halp_meta(name, "Geometry");
-      halp::position_normals_geometry mesh;
+      std::vector<halp::dynamic_geometry> mesh;
     } geometry;
   } outputs;
 
   void operator()();
 
-  struct worker
-  {
-    std::function<void(std::string)> request;
+  // Request a computation according to the currently defined program
+  void request_build();
+  // Appends geometry of the build gen to what is displayed
+  void apply_geometry(uint64_t gen, synth_mesh& mesh);
+  void rebuild_geometry();
+
+  // Called back in a JobSystem thread
+  // The returned function will be later applied in this object's processing thread
+  static std::function<void(StrucSynth&)>
+  build(std::string_view s, synth_options opts, synth_generation gen);
+  std::shared_ptr<job_mailbox<StrucSynth>> m_jobs
+      = std::make_shared<job_mailbox<StrucSynth>>();
+  // Builds requested while the node runs go first
+  std::chrono::steady_clock::time_point m_lastTick;
+
+  // Time to wait after the last keystroke in the program before building it
+  static constexpr auto debounce = std::chrono::milliseconds(250);
+  bool m_pendingEdit{};
+  std::chrono::steady_clock::time_point m_lastEdit;
+
+  // Incremented for each request, so that the builds of older ones stop early
+  std::shared_ptr<std::atomic<uint64_t>> m_generation
+      = std::make_shared<std::atomic<uint64_t>>(0);
+
+  // Geometry of progressive builds, filled by the worker
+  std::shared_ptr<synth_progress> m_progress = std::make_shared<synth_progress>();
+  synth_mesh m_chunk;
 
-    // Called back in a worker thread
-    // The returned function will be later applied in this object's processing thread
-    static std::function<void(StrucSynth&)> work(std::string_view s);
-  } worker;
+  // What is displayed, and the build it comes from
+  synth_mesh m_mesh;
+  uint64_t m_meshGeneration{};
 
-  using float_vec = boost::container::vector<float, ossia::pod_allocator<float>>;
-  float_vec m_vertexData;
+  // Unit meshes when instanced
+  synth_mesh m_boxMesh;
+  synth_mesh m_sphereMesh;
+  // Single instance of the triangles of an instanced model
+  float_vec m_identity;
 };
 
 }
@@ -0,0 +1,152 @@
+#include "SynthCache.hpp"
+
+#include <Threedim/Instancing.hpp>
+#include <Threedim/JobSystem.hpp>
+
+#include <QIODevice>
+
+#include <algorithm>
+
+namespace Threedim
+{
+// Models kept in memory, in bytes
+static constexpr int64_t synth_cache_budget = 256 * 1024 * 1024;
+
+// Models kept on disk, in bytes
+static constexpr int64_t synth_cache_disk_budget = 1024 * 1024 * 1024;
+
+static int64_t synth_cache_bytes(const synth_mesh& m) noexcept
+{
+  return int64_t(
+             m.positions.size() + m.normals.size() + m.boxes.size()
+             + m.spheres.size())
+             * sizeof(float)
+         + int64_t(m.colors.size()) * sizeof(uint32_t);
+}
+
+// The arrays of a mesh, in file order
+template <typename Mesh, typename F>
+static bool synth_cache_arrays(Mesh& m, F&& f)
+{
+  return f(m.positions) && f(m.normals) && f(m.colors) && f(m.boxes) && f(m.spheres);
+}
+
+SynthCache& SynthCache::instance()
+{
+  static SynthCache cache;
+  return cache;
+}
+
+// The magic is bumped whenever the file layout or the tessellation changes
+SynthCache::SynthCache()
+    : m_files{"structure-synth", ".bin", "SSY3", synth_cache_disk_budget}
+{
+}
+
+bool SynthCache::find(const QByteArray& key, synth_mesh& out)
+{
+  {
+    std::lock_guard lock{m_mutex};
+    if (auto it = m_entries.find(key); it != m_entries.end())
+    {
+      it->second.last_use = ++m_uses;
+      out = *it->second.mesh;
+      return true;
+    }
+  }
+
+  // Disk accesses happen outside of the lock
+  if (!m_files.read(key, [&out](QIODevice& f) { return read(f, out); }))
+    return false;
+
+  std::lock_guard lock{m_mutex};
+  store(key, std::make_shared<const synth_mesh>(out));
+  return true;
+}
+
+void SynthCache::insert(const QByteArray& key, const synth_mesh& mesh)
+{
+  auto copy = std::make_shared<const synth_mesh>(mesh);
+  {
+    std::lock_guard lock{m_mutex};
+    store(key, copy);
+  }
+
+  // Writing and trimming the directory can take a while: the caller does not
+  // wait for it. The job has its own BlobCache, which only holds paths, as it
+  // may still run while the statics are destroyed.
+  JobSystem::instance().submit(
+      nullptr,
+      job_priority::background,
+      [files = m_files, key, mesh = std::move(copy)]
+      { files.write(key, [&mesh](QIODevice& f) { write(f, *mesh); }); });
+}
+
+void SynthCache::store(const QByteArray& key, std::shared_ptr<const synth_mesh> mesh)
+{
+  const int64_t bytes = synth_cache_bytes(*mesh);
+  if (bytes > synth_cache_budget)
+    return;
+
+  if (auto it = m_entries.find(key); it != m_entries.end())
+  {
+    m_bytes -= it->second.bytes;
+    m_entries.erase(it);
+  }
+
+  while (m_bytes + bytes > synth_cache_budget && !m_entries.empty())
+  {
+    auto lru = std::min_element(
+        m_entries.begin(),
+        m_entries.end(),
+        [](const auto& a, const auto& b)
+        { return a.second.last_use < b.second.last_use; });
+    m_bytes -= lru->second.bytes;
+    m_entries.erase(lru);
+  }
+
+  m_bytes += bytes;
+  m_entries.insert_or_assign(key, entry{std::move(mesh), bytes, ++m_uses});
+}
+
+// Layout: for each array its element count followed by its contents
+bool SynthCache::read(QIODevice& f, synth_mesh& out)
+{
+  const bool ok = synth_cache_arrays(
+      out,
+      [&f](auto& v)
+      {
+        uint64_t count{};
+        if (f.read(reinterpret_cast<char*>(&count), sizeof(count)) != sizeof(count))
+          return false;
+        const int64_t bytes = count * sizeof(v[0]);
+        if (count > uint64_t(f.size()) || bytes > f.size() - f.pos())
+          return false;
+
+        v.resize(count);
+        return f.read(reinterpret_cast<char*>(v.data()), bytes) == bytes;
+      });
+  if (!ok)
+    return false;
+
+  // Files may be truncated or come from another version of the tessellation
+  const auto vertices = out.positions.size() / 3;
+  return out.positions.size() % 3 == 0 && out.positions.size() == out.normals.size()
+         && (out.colors.empty() || out.colors.size() == vertices)
+         && out.boxes.size() % instance_floats == 0
+         && out.spheres.size() % instance_floats == 0;
+}
+
+void SynthCache::write(QIODevice& f, const synth_mesh& mesh)
+{
+  synth_cache_arrays(
+      mesh,
+      [&f](const auto& v)
+      {
+        const uint64_t count = v.size();
+        f.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        f.write(reinterpret_cast<const char*>(v.data()), count * sizeof(v[0]));
+        return true;
+      });
+}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <Threedim/BlobCache.hpp>
+#include <Threedim/SynthMesh.hpp>
+
+#include <QByteArray>
+#include <QString>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace Threedim
+{
+/**
+ * @brief Cache of built Structure Synth models.
+ *
+ * Entries are keyed by a digest of everything the geometry depends on,
+ * see StructureSynth.cpp. They are kept in memory up to a budget, the
+ * least recently used ones being evicted first, and written to a BlobCache
+ * so that they survive restarts. The files are written by a JobSystem job:
+ * insert() only copies the mesh.
+ *
+ * All the functions can be called from any thread.
+ */
+class SynthCache
+{
+public:
+  static SynthCache& instance();
+
+  //! Copies the cached mesh into out, from memory or else from disk
+  bool find(const QByteArray& key, synth_mesh& out);
+
+  void insert(const QByteArray& key, const synth_mesh& mesh);
+
+private:
+  SynthCache();
+
+  static bool read(QIODevice& f, synth_mesh& out);
+  static void write(QIODevice& f, const synth_mesh& mesh);
+
+  // Caller must hold m_mutex
+  void store(const QByteArray& key, std::shared_ptr<const synth_mesh> mesh);
+
+  struct entry
+  {
+    //! Shared with the job writing it to disk
+    std::shared_ptr<const synth_mesh> mesh;
+    int64_t bytes{};
+    uint64_t last_use{};
+  };
+
+  std::mutex m_mutex;
+  std::map<QByteArray, entry> m_entries;
+  int64_t m_bytes{};
+  uint64_t m_uses{};
+  BlobCache m_files;
+};
+}
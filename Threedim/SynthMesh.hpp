@@ -0,0 +1,105 @@
+#pragma once
+
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <Threedim/TinyObj.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+
+namespace Threedim
+{
+using color_vec = boost::container::vector<uint32_t, ossia::pod_allocator<uint32_t>>;
+
+//! RGBA8, laid out in memory as expected by a unorm4 vertex attribute
+inline uint32_t synth_pack_color(const float (&rgba)[4]) noexcept
+{
+  uint8_t bytes[4];
+  for (int i = 0; i < 4; i++)
+    bytes[i] = uint8_t(std::clamp(rgba[i], 0.f, 1.f) * 255.f + 0.5f);
+
+  uint32_t res;
+  std::memcpy(&res, bytes, 4);
+  return res;
+}
+
+//! Geometry of a Structure Synth model
+struct synth_mesh
+{
+  //! Triangle soup, three floats per vertex
+  float_vec positions;
+  float_vec normals;
+  //! One synth_pack_color per vertex, empty in the unit meshes of SynthRenderer
+  color_vec colors;
+
+  //! instance_data of the boxes and spheres, when rendering with instancing
+  float_vec boxes;
+  float_vec spheres;
+
+  bool empty() const noexcept
+  {
+    return positions.empty() && boxes.empty() && spheres.empty();
+  }
+
+  void clear() noexcept
+  {
+    positions.clear();
+    normals.clear();
+    colors.clear();
+    boxes.clear();
+    spheres.clear();
+  }
+
+  void append(const synth_mesh& other)
+  {
+    positions.insert(positions.end(), other.positions.begin(), other.positions.end());
+    normals.insert(normals.end(), other.normals.begin(), other.normals.end());
+    colors.insert(colors.end(), other.colors.begin(), other.colors.end());
+    boxes.insert(boxes.end(), other.boxes.begin(), other.boxes.end());
+    spheres.insert(spheres.end(), other.spheres.begin(), other.spheres.end());
+  }
+};
+
+/**
+ * @brief Hands the geometry of a build in progress to the execution thread.
+ *
+ * The worker publishes the primitives produced since its last publication,
+ * the execution thread takes everything accumulated so far and appends it
+ * to what it displays.
+ */
+struct synth_progress
+{
+  //! Called from the worker thread
+  void publish(uint64_t generation, const synth_mesh& mesh)
+  {
+    std::lock_guard lock{m_mutex};
+    // Leftovers of an older build were never taken
+    if (generation != m_generation)
+    {
+      m_chunk.clear();
+      m_generation = generation;
+    }
+    m_chunk.append(mesh);
+  }
+
+  //! Called from the execution thread: does not wait for the worker
+  bool take(uint64_t& generation, synth_mesh& out)
+  {
+    std::unique_lock lock{m_mutex, std::try_to_lock};
+    if (!lock.owns_lock() || m_chunk.empty())
+      return false;
+
+    generation = m_generation;
+    out.clear();
+    std::swap(out, m_chunk);
+    return true;
+  }
+
+private:
+  std::mutex m_mutex;
+  uint64_t m_generation{};
+  synth_mesh m_chunk;
+};
+}
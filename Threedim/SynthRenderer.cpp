@@ -0,0 +1,529 @@
+#include "SynthRenderer.hpp"
+
+#include <Threedim/ThreadPool.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numbers>
+
+namespace Threedim
+{
+// Primitives per task when tessellating
+static constexpr int64_t synth_chunk_size = 1024;
+
+// With a triangle budget: initial tessellation error, relative to the model size
+static constexpr float synth_sphere_tolerance = 5e-4f;
+static constexpr int synth_min_sphere_dt = 6;
+static constexpr int synth_max_sphere_dt = 64;
+
+static constexpr int64_t synth_sphere_triangles(int dt, int dp) noexcept
+{
+  return 2 * dt * (dp - 1);
+}
+
+static QVector3D toQt(const ssynth::Math::Vector3f& v) noexcept
+{
+  return {v.x(), v.y(), v.z()};
+}
+
+namespace
+{
+// Writes the vertices of one primitive at its place in the output
+struct synth_writer
+{
+  float* p{};
+  float* n{};
+  uint32_t* rgba{};
+  uint32_t color{};
+
+  void vertex(QVector3D pos, QVector3D nrm) noexcept
+  {
+    p[0] = pos.x();
+    p[1] = pos.y();
+    p[2] = pos.z();
+    n[0] = nrm.x();
+    n[1] = nrm.y();
+    n[2] = nrm.z();
+    p += 3;
+    n += 3;
+    if (rgba)
+      *rgba++ = color;
+  }
+
+  void triangle(QVector3D a, QVector3D b, QVector3D c) noexcept
+  {
+    const QVector3D nrm = QVector3D::crossProduct(b - a, c - a).normalized();
+    vertex(a, nrm);
+    vertex(b, nrm);
+    vertex(c, nrm);
+  }
+
+  void quad(QVector3D a, QVector3D b, QVector3D c, QVector3D d) noexcept
+  {
+    triangle(a, b, c);
+    triangle(a, c, d);
+  }
+
+  void box(QVector3D o, QVector3D d1, QVector3D d2, QVector3D d3) noexcept
+  {
+    // The frame can be mirrored by negative scales:
+    // flip the winding so that the faces still point outwards
+    if (QVector3D::dotProduct(QVector3D::crossProduct(d1, d2), d3) < 0.f)
+      std::swap(d1, d2);
+
+    const QVector3D o1 = o + d1, o2 = o + d2, o3 = o + d3;
+    const QVector3D o12 = o1 + d2, o13 = o1 + d3, o23 = o2 + d3, o123 = o12 + d3;
+
+    quad(o, o2, o12, o1);
+    quad(o3, o13, o123, o23);
+    quad(o, o1, o13, o3);
+    quad(o2, o23, o123, o12);
+    quad(o, o3, o23, o2);
+    quad(o1, o12, o123, o13);
+  }
+
+  // The four sides of the tube going from the start to the end rectangle
+  void tube(const QVector3D (&v)[6]) noexcept
+  {
+    const QVector3D s0 = v[0], e0 = v[3];
+    const QVector3D s1 = s0 + v[1], e1 = e0 + v[4];
+    const QVector3D s2 = s0 + v[2], e2 = e0 + v[5];
+    const QVector3D s3 = s1 + v[2], e3 = e1 + v[5];
+
+    quad(s0, s1, e1, e0);
+    quad(s1, s3, e3, e1);
+    quad(s3, s2, e2, e3);
+    quad(s2, s0, e0, e2);
+  }
+
+  void sphere(QVector3D c, float radius, int dt, int dp) noexcept
+  {
+    auto at = [&](int i, int j)
+    {
+      const float theta = 2.f * std::numbers::pi_v<float> * i / dt;
+      const float phi = std::numbers::pi_v<float> * j / dp;
+      return QVector3D{
+          std::cos(theta) * std::sin(phi),
+          std::cos(phi),
+          std::sin(theta) * std::sin(phi)};
+    };
+
+    // Smooth normals: the unit vector from the center
+    for (int j = 0; j < dp; j++)
+    {
+      for (int i = 0; i < dt; i++)
+      {
+        const QVector3D n00 = at(i, j), n10 = at(i + 1, j);
+        const QVector3D n01 = at(i, j + 1), n11 = at(i + 1, j + 1);
+        if (j > 0)
+        {
+          vertex(c + radius * n00, n00);
+          vertex(c + radius * n10, n10);
+          vertex(c + radius * n11, n11);
+        }
+        if (j < dp - 1)
+        {
+          vertex(c + radius * n00, n00);
+          vertex(c + radius * n11, n11);
+          vertex(c + radius * n01, n01);
+        }
+      }
+    }
+  }
+};
+}
+
+SynthRenderer::SynthRenderer(int sphereDT, int sphereDP, bool instanced)
+    : m_sphereDT{std::max(sphereDT, 3)}
+    , m_sphereDP{std::max(sphereDP, 2)}
+    , m_instanced{instanced}
+{
+}
+
+void SynthRenderer::record(primitive p)
+{
+  p.color = synth_pack_color(m_color);
+  p.sphereDT = m_sphereDT;
+  p.sphereDP = m_sphereDP;
+
+  if (m_budget > 0)
+  {
+    switch (p.kind)
+    {
+      case primitive::box:
+        grow_bounds(p.v[0]);
+        grow_bounds(p.v[0] + p.v[1] + p.v[2] + p.v[3]);
+        break;
+      case primitive::tube:
+        grow_bounds(p.v[0]);
+        grow_bounds(p.v[3]);
+        break;
+      case primitive::sphere:
+        grow_bounds(p.v[0] - QVector3D{p.radius, p.radius, p.radius});
+        grow_bounds(p.v[0] + QVector3D{p.radius, p.radius, p.radius});
+        break;
+      case primitive::triangle:
+        grow_bounds(p.v[0]);
+        grow_bounds(p.v[1]);
+        grow_bounds(p.v[2]);
+        break;
+    }
+  }
+
+  m_primitives.push_back(p);
+}
+
+void SynthRenderer::grow_bounds(QVector3D p) noexcept
+{
+  if (!m_hasBounds)
+  {
+    m_min = m_max = p;
+    m_hasBounds = true;
+    return;
+  }
+  m_min = {std::min(m_min.x(), p.x()), std::min(m_min.y(), p.y()), std::min(m_min.z(), p.z())};
+  m_max = {std::max(m_max.x(), p.x()), std::max(m_max.y(), p.y()), std::max(m_max.z(), p.z())};
+}
+
+int64_t SynthRenderer::fit_budget()
+{
+  const int64_t count = m_primitives.size();
+  if (m_budget <= 0)
+    return count;
+
+  auto triangles = [](const primitive& p) -> int64_t
+  {
+    switch (p.kind)
+    {
+      case primitive::box:
+        return 12;
+      case primitive::tube:
+        return 8;
+      case primitive::sphere:
+        return synth_sphere_triangles(p.sphereDT, p.sphereDP);
+      case primitive::triangle:
+      default:
+        return 1;
+    }
+  };
+
+  // Segments such that r * (1 - cos(pi / segments)) <= tolerance
+  auto detail = [](primitive& p, float tolerance)
+  {
+    // Written so that a NaN radius gives the coarsest sphere
+    float ratio = tolerance / std::max(p.radius, 1e-20f);
+    ratio = ratio < 1.f ? ratio : 1.f;
+    const float segments = std::ceil(std::numbers::pi_v<float> / std::acos(1.f - ratio));
+    const int dt = std::clamp(
+        int(std::min(segments, float(synth_max_sphere_dt))),
+        synth_min_sphere_dt,
+        synth_max_sphere_dt);
+    p.sphereDT = dt;
+    p.sphereDP = std::max(dt / 2, 3);
+  };
+
+  float max_radius = 0.f;
+  for (const primitive& p : m_primitives)
+    if (p.kind == primitive::sphere)
+      max_radius = std::max(max_radius, p.radius);
+
+  const int64_t remaining = std::max(m_budget - m_triangles, int64_t(0));
+  const float extent = (m_max - m_min).length();
+
+  // Programs can produce infinite or NaN coordinates: the tolerance would never
+  // reach max_radius. The spheres then keep their tessellation.
+  const bool refine = std::isfinite(extent) && std::isfinite(max_radius);
+
+  float tolerance = synth_sphere_tolerance * extent;
+  int64_t total = 0;
+  for (;;)
+  {
+    total = 0;
+    for (primitive& p : m_primitives)
+    {
+      if (refine && p.kind == primitive::sphere)
+        detail(p, tolerance);
+      total += triangles(p);
+    }
+
+    // Past max_radius, all the spheres are at their coarsest
+    if (!refine || total <= remaining || tolerance >= max_radius)
+      break;
+    tolerance = std::max(tolerance * 2.f, 1e-20f);
+  }
+
+  // Still too large even with the coarsest spheres: keep what fits
+  int64_t kept = count;
+  if (total > remaining)
+  {
+    total = 0;
+    for (kept = 0; kept < count; kept++)
+    {
+      const int64_t t = triangles(m_primitives[kept]);
+      if (total + t > remaining)
+        break;
+      total += t;
+    }
+  }
+
+  m_triangles += total;
+  return kept;
+}
+
+synth_mesh SynthRenderer::unit_box()
+{
+  SynthRenderer r{3, 2};
+  r.m_colors = false;
+  r.record(
+      {.kind = primitive::box, .v = {{0, 0, 0}, {1, 0, 0}, {0, 1, 0}, {0, 0, 1}}});
+  synth_mesh m;
+  r.finish(m);
+  return m;
+}
+
+synth_mesh SynthRenderer::unit_sphere(int sphereDT, int sphereDP)
+{
+  SynthRenderer r{sphereDT, sphereDP};
+  r.m_colors = false;
+  r.record({.kind = primitive::sphere, .v = {}, .radius = 1.f});
+  synth_mesh m;
+  r.finish(m);
+  return m;
+}
+
+void SynthRenderer::publish_every(
+    int64_t objects,
+    std::chrono::milliseconds interval,
+    std::function<void(const synth_mesh&)> publish)
+{
+  m_publishObjects = std::max(objects, int64_t(1));
+  m_publishInterval = interval;
+  m_publish = std::move(publish);
+  m_lastPublish = std::chrono::steady_clock::now();
+  m_objects = 0;
+}
+
+void SynthRenderer::begin_primitive()
+{
+  check_cancelled();
+  if (!m_publish)
+    return;
+
+  // Reading the clock for every primitive would cost more than the primitive
+  ++m_objects;
+  if (m_objects < m_publishObjects && m_objects % 256 != 0)
+    return;
+
+  const auto now = std::chrono::steady_clock::now();
+  if (m_objects < m_publishObjects && now - m_lastPublish < m_publishInterval)
+    return;
+
+  tessellate();
+  if (!m_mesh.empty())
+  {
+    m_publish(m_mesh);
+    m_mesh.clear();
+  }
+  m_objects = 0;
+  m_lastPublish = now;
+}
+
+void SynthRenderer::tessellate()
+{
+  const int64_t count = fit_budget();
+  if (count == 0)
+  {
+    m_primitives.clear();
+    return;
+  }
+
+  auto vertex_count = [&](const primitive& p) -> int64_t
+  {
+    switch (p.kind)
+    {
+      case primitive::box:
+        return 36;
+      case primitive::tube:
+        return 24;
+      case primitive::sphere:
+        return 3 * synth_sphere_triangles(p.sphereDT, p.sphereDP);
+      case primitive::triangle:
+      default:
+        return 3;
+    }
+  };
+
+  // Where each primitive starts in the output
+  std::vector<int64_t> offsets(count + 1);
+  offsets[0] = m_mesh.positions.size() / 3;
+  for (int64_t i = 0; i < count; i++)
+    offsets[i + 1] = offsets[i] + vertex_count(m_primitives[i]);
+
+  m_mesh.positions.resize(offsets[count] * 3);
+  m_mesh.normals.resize(offsets[count] * 3);
+  if (m_colors)
+    m_mesh.colors.resize(offsets[count]);
+
+  auto work = [&](int64_t begin, int64_t end)
+  {
+    for (int64_t i = begin; i < end; i++)
+    {
+      const primitive& p = m_primitives[i];
+      synth_writer w{
+          .p = m_mesh.positions.data() + offsets[i] * 3,
+          .n = m_mesh.normals.data() + offsets[i] * 3,
+          .rgba = m_colors ? m_mesh.colors.data() + offsets[i] : nullptr,
+          .color = p.color};
+      switch (p.kind)
+      {
+        case primitive::box:
+          w.box(p.v[0], p.v[1], p.v[2], p.v[3]);
+          break;
+        case primitive::tube:
+          w.tube(p.v);
+          break;
+        case primitive::sphere:
+          w.sphere(p.v[0], p.radius, p.sphereDT, p.sphereDP);
+          break;
+        case primitive::triangle:
+          w.triangle(p.v[0], p.v[1], p.v[2]);
+          break;
+      }
+    }
+  };
+
+  if (count < 4 * synth_chunk_size)
+    work(0, count);
+  else
+    ThreadPool::instance().parallel_for(count, synth_chunk_size, work);
+
+  m_primitives.clear();
+}
+
+void SynthRenderer::instance(
+    float_vec& out,
+    int64_t triangles,
+    QVector3D o,
+    QVector3D d1,
+    QVector3D d2,
+    QVector3D d3)
+{
+  // Instances are counted as they come, before the tessellated primitives
+  if (m_budget > 0)
+  {
+    if (m_triangles + triangles > m_budget)
+      return;
+    m_triangles += triangles;
+  }
+
+  // Keep a direct frame so that the winding of the unit mesh is preserved:
+  // the same box is spanned from the opposite corner along dir1.
+  if (QVector3D::dotProduct(QVector3D::crossProduct(d1, d2), d3) < 0.f)
+  {
+    o = o + d1;
+    d1 = -1.f * d1;
+  }
+
+  instance_data inst{
+      .transform
+      = {d1.x(), d1.y(), d1.z(), 0.f, d2.x(), d2.y(), d2.z(), 0.f,
+         d3.x(), d3.y(), d3.z(), 0.f, o.x(),  o.y(),  o.z(),  1.f},
+      .color = {m_color[0], m_color[1], m_color[2], m_color[3]}};
+  const float* f = inst.transform;
+  out.insert(out.end(), f, f + instance_floats);
+}
+
+void SynthRenderer::drawBox(
+    Vector3f base,
+    Vector3f dir1,
+    Vector3f dir2,
+    Vector3f dir3,
+    PrimitiveClass*)
+{
+  begin_primitive();
+  if (m_instanced)
+    instance(m_mesh.boxes, 12, toQt(base), toQt(dir1), toQt(dir2), toQt(dir3));
+  else
+    record(
+        {.kind = primitive::box,
+         .v = {toQt(base), toQt(dir1), toQt(dir2), toQt(dir3)}});
+}
+
+void SynthRenderer::drawGrid(
+    Vector3f base,
+    Vector3f dir1,
+    Vector3f dir2,
+    Vector3f dir3,
+    PrimitiveClass* classID)
+{
+  drawBox(base, dir1, dir2, dir3, classID);
+}
+
+void SynthRenderer::drawMesh(
+    Vector3f startBase,
+    Vector3f startDir1,
+    Vector3f startDir2,
+    Vector3f endBase,
+    Vector3f endDir1,
+    Vector3f endDir2,
+    PrimitiveClass*)
+{
+  begin_primitive();
+  record(
+      {.kind = primitive::tube,
+       .v
+       = {toQt(startBase), toQt(startDir1), toQt(startDir2), toQt(endBase),
+          toQt(endDir1), toQt(endDir2)}});
+}
+
+void SynthRenderer::drawLine(Vector3f, Vector3f, PrimitiveClass*) { }
+
+void SynthRenderer::drawDot(Vector3f, PrimitiveClass*) { }
+
+void SynthRenderer::drawSphere(Vector3f center, float radius, PrimitiveClass*)
+{
+  begin_primitive();
+  if (m_instanced)
+    instance(
+        m_mesh.spheres,
+        synth_sphere_triangles(m_sphereDT, m_sphereDP),
+        toQt(center),
+        {radius, 0, 0},
+        {0, radius, 0},
+        {0, 0, radius});
+  else
+    record(
+        {.kind = primitive::sphere, .v = {toQt(center)}, .radius = radius});
+}
+
+void SynthRenderer::drawTriangle(Vector3f p1, Vector3f p2, Vector3f p3, PrimitiveClass*)
+{
+  begin_primitive();
+  record(
+      {.kind = primitive::triangle, .v = {toQt(p1), toQt(p2), toQt(p3)}});
+}
+
+void SynthRenderer::setColor(Vector3f rgb)
+{
+  m_color[0] = rgb.x();
+  m_color[1] = rgb.y();
+  m_color[2] = rgb.z();
+}
+
+void SynthRenderer::setAlpha(double alpha)
+{
+  m_color[3] = alpha;
+}
+
+void SynthRenderer::setBackgroundColor(Vector3f) { }
+void SynthRenderer::setPreviousColor(Vector3f) { }
+void SynthRenderer::setPreviousAlpha(double) { }
+
+void SynthRenderer::finish(synth_mesh& out)
+{
+  tessellate();
+  out = std::move(m_mesh);
+  m_mesh = {};
+}
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <Threedim/Instancing.hpp>
+#include <Threedim/SynthMesh.hpp>
+#include <ssynth/Model/Rendering/Renderer.h>
+
+#include <QVector3D>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+namespace Threedim
+{
+//! Thrown from the draw calls to stop the Builder when the build became stale
+struct synth_cancelled
+{
+};
+
+/**
+ * @brief Renders a Structure Synth model directly as triangles.
+ *
+ * Positions and normals are accumulated as a flat-shaded triangle soup,
+ * with the color and alpha of each object as a per-vertex RGBA8 color.
+ * The draw calls only record the primitives: they are tessellated in parallel
+ * on the ThreadPool when the geometry is handed over, each primitive
+ * writing at a precomputed offset so that the output does not depend on
+ * the number of threads.
+ *
+ * With instancing, boxes and spheres are recorded as a transform and a color
+ * applied to unit_box() and unit_sphere() instead, and only the other
+ * primitives are tessellated.
+ *
+ * Lines and dots have no surface and are skipped, grids are drawn as boxes.
+ *
+ * The Builder has no way to be interrupted: once cancel_when() was set,
+ * each primitive checks whether the build is still wanted, and throws
+ * synth_cancelled otherwise.
+ *
+ * With publish_every(), the geometry produced so far is regularly handed
+ * over during the build, so that large models can be displayed progressively.
+ *
+ * With a triangle budget, the tessellation of each sphere follows its size
+ * relative to the model instead of being fixed: the number of segments keeps
+ * the distance between the sphere and its tessellation under a fraction of
+ * the model size. That tolerance is relaxed until the model fits in the
+ * budget, and the primitives which still do not fit are dropped.
+ */
+class SynthRenderer final : public ssynth::Model::Rendering::Renderer
+{
+public:
+  using Vector3f = ssynth::Math::Vector3f;
+  using PrimitiveClass = ssynth::Model::PrimitiveClass;
+
+  SynthRenderer(int sphereDT, int sphereDP, bool instanced = false);
+
+  //! Box spanning [0; 1]^3
+  static synth_mesh unit_box();
+  //! Sphere of radius 1 centered on the origin
+  static synth_mesh unit_sphere(int sphereDT, int sphereDP);
+
+  //! Cancels the build as soon as latest no longer holds generation
+  void cancel_when(const std::atomic<uint64_t>* latest, uint64_t generation) noexcept
+  {
+    m_latest = latest;
+    m_generation = generation;
+  }
+
+  //! Hands over the pending geometry every objects primitives or every interval
+  void publish_every(
+      int64_t objects,
+      std::chrono::milliseconds interval,
+      std::function<void(const synth_mesh&)> publish);
+
+  //! Maximum number of triangles in the output, 0 for unlimited
+  void set_triangle_budget(int64_t triangles) noexcept { m_budget = triangles; }
+
+  QString renderName() override { return "SynthRenderer"; }
+
+  void drawBox(
+      Vector3f base,
+      Vector3f dir1,
+      Vector3f dir2,
+      Vector3f dir3,
+      PrimitiveClass* classID) override;
+  void drawMesh(
+      Vector3f startBase,
+      Vector3f startDir1,
+      Vector3f startDir2,
+      Vector3f endBase,
+      Vector3f endDir1,
+      Vector3f endDir2,
+      PrimitiveClass* classID) override;
+  void drawGrid(
+      Vector3f base,
+      Vector3f dir1,
+      Vector3f dir2,
+      Vector3f dir3,
+      PrimitiveClass* classID) override;
+  void drawLine(Vector3f from, Vector3f to, PrimitiveClass* classID) override;
+  void drawDot(Vector3f pos, PrimitiveClass* classID) override;
+  void drawSphere(Vector3f center, float radius, PrimitiveClass* classID) override;
+  void drawTriangle(Vector3f p1, Vector3f p2, Vector3f p3, PrimitiveClass* classID)
+      override;
+
+  void setColor(Vector3f rgb) override;
+  void setBackgroundColor(Vector3f rgb) override;
+  void setAlpha(double alpha) override;
+  void setPreviousColor(Vector3f rgb) override;
+  void setPreviousAlpha(double alpha) override;
+
+  //! Moves the pending geometry into out. The renderer is empty afterwards.
+  void finish(synth_mesh& out);
+
+private:
+  //! A primitive drawn by the Builder, waiting for tessellation
+  struct primitive
+  {
+    enum kind_t : uint8_t
+    {
+      box,
+      tube,
+      sphere,
+      triangle
+    } kind{};
+    //! Corners and directions, in the order of the draw call arguments
+    QVector3D v[6];
+    float radius{};
+    uint32_t color{};
+    //! Sphere tessellation, chosen when tessellating
+    int sphereDT{};
+    int sphereDP{};
+  };
+
+  void check_cancelled() const
+  {
+    if (m_latest && m_latest->load(std::memory_order_relaxed) != m_generation)
+      throw synth_cancelled{};
+  }
+
+  // Called before drawing each primitive
+  void begin_primitive();
+
+  // Tessellates the recorded primitives at the end of m_mesh
+  void tessellate();
+  // Records a primitive with the current color
+  void record(primitive p);
+  void grow_bounds(QVector3D p) noexcept;
+  // Chooses the sphere tessellations, returns how many primitives fit in the budget
+  int64_t fit_budget();
+  void instance(
+      float_vec& out,
+      int64_t triangles,
+      QVector3D base,
+      QVector3D dir1,
+      QVector3D dir2,
+      QVector3D dir3);
+
+  const std::atomic<uint64_t>* m_latest{};
+  uint64_t m_generation{};
+
+  std::function<void(const synth_mesh&)> m_publish;
+  int64_t m_publishObjects{};
+  std::chrono::milliseconds m_publishInterval{};
+  std::chrono::steady_clock::time_point m_lastPublish;
+  int64_t m_objects{};
+
+  int64_t m_budget{};
+  int64_t m_triangles{};
+  QVector3D m_min{}, m_max{};
+  bool m_hasBounds{};
+
+  int m_sphereDT{};
+  int m_sphereDP{};
+  bool m_instanced{};
+  // Disabled for the unit meshes of instancing, which use the instance colors
+  bool m_colors{true};
+  float m_color[4]{1.f, 1.f, 1.f, 1.f};
+
+  std::vector<primitive> m_primitives;
+
+  synth_mesh m_mesh;
+};
+}
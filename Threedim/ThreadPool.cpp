@@ -0,0 +1,139 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+
+namespace Threedim
+{
+ThreadPool& ThreadPool::instance()
+{
+  static ThreadPool pool{std::max(1, int(std::thread::hardware_concurrency()) - 1)};
+  return pool;
+}
+
+ThreadPool::ThreadPool(int workers)
+    : m_queues{std::make_unique<chunk_queue[]>(workers + 1)}
+{
+  m_workers.reserve(workers);
+  for (int i = 0; i < workers; i++)
+    m_workers.emplace_back([this, i] { worker_loop(i + 1); });
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard lock{m_mutex};
+    m_stop = true;
+  }
+  m_startCv.notify_all();
+  for (auto& t : m_workers)
+    t.join();
+}
+
+bool ThreadPool::chunk_queue::pop_front(int64_t& chunk)
+{
+  std::lock_guard lock{mutex};
+  if (begin == end)
+    return false;
+  chunk = begin++;
+  return true;
+}
+
+bool ThreadPool::chunk_queue::steal_back(int64_t& chunk)
+{
+  std::lock_guard lock{mutex};
+  if (begin == end)
+    return false;
+  chunk = --end;
+  return true;
+}
+
+void ThreadPool::run(int64_t count, int64_t grain, chunk_function f, void* ctx)
+{
+  if (count <= 0)
+    return;
+
+  grain = std::max(grain, int64_t(1));
+  const int64_t chunks = (count + grain - 1) / grain;
+  if (chunks <= 1 || m_workers.empty())
+  {
+    f(ctx, 0, count);
+    return;
+  }
+
+  std::unique_lock run_lock{m_runMutex, std::try_to_lock};
+  if (!run_lock.owns_lock())
+  {
+    f(ctx, 0, count);
+    return;
+  }
+
+  const int participants = int(std::min(chunks, int64_t(concurrency())));
+  for (int i = 0; i < participants; i++)
+  {
+    m_queues[i].begin = chunks * i / participants;
+    m_queues[i].end = chunks * (i + 1) / participants;
+  }
+
+  m_function = f;
+  m_context = ctx;
+  m_count = count;
+  m_grain = grain;
+
+  {
+    std::lock_guard lock{m_mutex};
+    m_participants = participants;
+    m_busy = participants - 1;
+    m_generation++;
+  }
+  m_startCv.notify_all();
+
+  work(0);
+
+  std::unique_lock lock{m_mutex};
+  m_doneCv.wait(lock, [this] { return m_busy == 0; });
+}
+
+void ThreadPool::work(int participant)
+{
+  const auto process = [this](int64_t chunk)
+  {
+    const int64_t b = chunk * m_grain;
+    const int64_t e = std::min(b + m_grain, m_count);
+    m_function(m_context, b, e);
+  };
+
+  int64_t chunk{};
+  while (m_queues[participant].pop_front(chunk))
+    process(chunk);
+
+  for (int k = 1; k < m_participants; k++)
+  {
+    auto& victim = m_queues[(participant + k) % m_participants];
+    while (victim.steal_back(chunk))
+      process(chunk);
+  }
+}
+
+void ThreadPool::worker_loop(int participant)
+{
+  uint64_t generation = 0;
+  std::unique_lock lock{m_mutex};
+  for (;;)
+  {
+    m_startCv.wait(lock, [&] { return m_stop || m_generation != generation; });
+    if (m_stop)
+      return;
+
+    generation = m_generation;
+    if (participant >= m_participants)
+      continue;
+
+    lock.unlock();
+    work(participant);
+    lock.lock();
+
+    if (--m_busy == 0)
+      m_doneCv.notify_one();
+  }
+}
+}
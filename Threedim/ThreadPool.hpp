@@ -0,0 +1,82 @@
+#pragma once
+
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace Threedim
+{
+/**
+ * @brief Fixed set of worker threads for data-parallel loops over vertices.
+ *
+ * A loop is cut into chunks which are first distributed evenly between the
+ * participating threads (the calling thread included); threads which are done
+ * with their own chunks steal the remaining ones from the back of the others' queues.
+ *
+ * Only one loop runs on the pool at a time: if the pool is already in use,
+ * e.g. by another node in a parallel execution graph, the loop runs inline.
+ */
+class ThreadPool
+{
+public:
+  static ThreadPool& instance();
+
+  explicit ThreadPool(int workers);
+  ~ThreadPool();
+
+  //! Number of threads a loop can run on, the caller included
+  int concurrency() const noexcept { return int(m_workers.size()) + 1; }
+
+  //! Calls f(begin, end) on sub-ranges of at most `grain` elements of [0; count)
+  template <typename F>
+  void parallel_for(int64_t count, int64_t grain, F&& f)
+  {
+    using func_t = std::remove_reference_t<F>;
+    run(
+        count,
+        grain,
+        [](void* ctx, int64_t b, int64_t e) { (*static_cast<func_t*>(ctx))(b, e); },
+        (void*)&f);
+  }
+
+private:
+  using chunk_function = void (*)(void*, int64_t, int64_t);
+  struct alignas(64) chunk_queue
+  {
+    std::mutex mutex;
+    int64_t begin{};
+    int64_t end{};
+
+    bool pop_front(int64_t& chunk);
+    bool steal_back(int64_t& chunk);
+  };
+
+  void run(int64_t count, int64_t grain, chunk_function f, void* ctx);
+  void work(int participant);
+  void worker_loop(int participant);
+
+  std::vector<std::thread> m_workers;
+  std::unique_ptr<chunk_queue[]> m_queues;
+
+  // Current loop
+  chunk_function m_function{};
+  void* m_context{};
+  int64_t m_count{};
+  int64_t m_grain{};
+  int m_participants{};
+
+  std::mutex m_runMutex;
+  std::mutex m_mutex;
+  std::condition_variable m_startCv;
+  std::condition_variable m_doneCv;
+  uint64_t m_generation{};
+  int m_busy{};
+  bool m_stop{};
+};
+}